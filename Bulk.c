@@ -0,0 +1,281 @@
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Bulk memory kernels
+ * License:         MIT
+ *
+ * Byte copies and fills go to memmove/memset: libc already selects SSE2,
+ * AVX2 or rep movsb for the running CPU, and a hand-written loop would only
+ * match it. The cell-array reductions have no libc counterpart, so they
+ * come in scalar, SSE2 and AVX2 versions and the best one the CPU supports
+ * is chosen on first use.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include "Bulk.h"
+
+/* the vector kernels work on 32-bit lanes; 64-bit cells get the scalar ones */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(YAFI_CELL_64)
+#define BULK_X86
+#include <immintrin.h>
+#endif
+
+void bulk_copy(uint8_t *dest, const uint8_t *src, size_t n) {
+    memmove(dest, src, n);
+}
+
+void bulk_fill(uint8_t *dest, int value, size_t n) {
+    memset(dest, value, n);
+}
+
+/*
+ *  SCALAR
+ */
+
+/* cells wrap like + does */
+static Cell sum_scalar(const Cell *cells, size_t n) {
+    UCell sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += (UCell)cells[i];
+    return (Cell)sum;
+}
+
+static Cell min_scalar(const Cell *cells, size_t n) {
+    Cell min = cells[0];
+    for (size_t i = 1; i < n; i++)
+        min = (cells[i] < min) ? cells[i] : min;
+    return min;
+}
+
+static Cell max_scalar(const Cell *cells, size_t n) {
+    Cell max = cells[0];
+    for (size_t i = 1; i < n; i++)
+        max = (cells[i] > max) ? cells[i] : max;
+    return max;
+}
+
+static size_t search_scalar(const Cell *cells, size_t n, Cell value) {
+    for (size_t i = 0; i < n; i++) {
+        if (cells[i] == value)
+            return i;
+    }
+    return n;
+}
+
+static size_t mismatch_scalar(const Cell *a, const Cell *b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] != b[i])
+            return i;
+    }
+    return n;
+}
+
+static const BulkKernels scalar = {
+    "scalar", sum_scalar, min_scalar, max_scalar, search_scalar, mismatch_scalar
+};
+
+#ifdef BULK_X86
+
+/*
+ *  SSE2: 4 cells per vector, always present on x86-64
+ */
+
+static Cell sum_sse2(const Cell *cells, size_t n) {
+    __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_epi32(acc0, _mm_loadu_si128((const __m128i *)(cells + i)));
+        acc1 = _mm_add_epi32(acc1, _mm_loadu_si128((const __m128i *)(cells + i + 4)));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi32(acc0, acc1));
+    uint32_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return (int)(sum + (uint32_t)sum_scalar(cells + i, n - i));
+}
+
+/* SSE2 has no pminsd/pmaxsd; select through a compare mask */
+static inline __m128i min_epi32_sse2(__m128i a, __m128i b) {
+    __m128i lt = _mm_cmplt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(lt, a), _mm_andnot_si128(lt, b));
+}
+
+static inline __m128i max_epi32_sse2(__m128i a, __m128i b) {
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+static Cell min_sse2(const Cell *cells, size_t n) {
+    if (n < 4)
+        return min_scalar(cells, n);
+    __m128i acc = _mm_loadu_si128((const __m128i *)cells);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4)
+        acc = min_epi32_sse2(acc, _mm_loadu_si128((const __m128i *)(cells + i)));
+    int lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    int min = min_scalar(lanes, 4);
+    if (i < n) {
+        int tail = min_scalar(cells + i, n - i);
+        min = (tail < min) ? tail : min;
+    }
+    return min;
+}
+
+static Cell max_sse2(const Cell *cells, size_t n) {
+    if (n < 4)
+        return max_scalar(cells, n);
+    __m128i acc = _mm_loadu_si128((const __m128i *)cells);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4)
+        acc = max_epi32_sse2(acc, _mm_loadu_si128((const __m128i *)(cells + i)));
+    int lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    int max = max_scalar(lanes, 4);
+    if (i < n) {
+        int tail = max_scalar(cells + i, n - i);
+        max = (tail > max) ? tail : max;
+    }
+    return max;
+}
+
+static size_t search_sse2(const Cell *cells, size_t n, Cell value) {
+    __m128i needle = _mm_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(cells + i)), needle);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        if (mask)
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + search_scalar(cells + i, n - i, value);
+}
+
+static size_t mismatch_sse2(const Cell *a, const Cell *b, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(a + i)),
+                                     _mm_loadu_si128((const __m128i *)(b + i)));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq)) ^ 0xf;
+        if (mask)
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + mismatch_scalar(a + i, b + i, n - i);
+}
+
+static const BulkKernels sse2 = {
+    "sse2", sum_sse2, min_sse2, max_sse2, search_sse2, mismatch_sse2
+};
+
+/*
+ *  AVX2: 8 cells per vector, only when the CPU reports it
+ */
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static Cell sum_avx2(const Cell *cells, size_t n) {
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_add_epi32(acc0, _mm256_loadu_si256((const __m256i *)(cells + i)));
+        acc1 = _mm256_add_epi32(acc1, _mm256_loadu_si256((const __m256i *)(cells + i + 8)));
+    }
+    acc0 = _mm256_add_epi32(acc0, acc1);
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, half);
+    uint32_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return (int)(sum + (uint32_t)sum_sse2(cells + i, n - i));
+}
+
+AVX2 static Cell min_avx2(const Cell *cells, size_t n) {
+    if (n < 8)
+        return min_scalar(cells, n);
+    __m256i acc = _mm256_loadu_si256((const __m256i *)cells);
+    size_t i = 8;
+    for (; i + 8 <= n; i += 8)
+        acc = _mm256_min_epi32(acc, _mm256_loadu_si256((const __m256i *)(cells + i)));
+    int lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    int min = min_scalar(lanes, 8);
+    if (i < n) {
+        int tail = min_scalar(cells + i, n - i);
+        min = (tail < min) ? tail : min;
+    }
+    return min;
+}
+
+AVX2 static Cell max_avx2(const Cell *cells, size_t n) {
+    if (n < 8)
+        return max_scalar(cells, n);
+    __m256i acc = _mm256_loadu_si256((const __m256i *)cells);
+    size_t i = 8;
+    for (; i + 8 <= n; i += 8)
+        acc = _mm256_max_epi32(acc, _mm256_loadu_si256((const __m256i *)(cells + i)));
+    int lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    int max = max_scalar(lanes, 8);
+    if (i < n) {
+        int tail = max_scalar(cells + i, n - i);
+        max = (tail > max) ? tail : max;
+    }
+    return max;
+}
+
+AVX2 static size_t search_avx2(const Cell *cells, size_t n, Cell value) {
+    __m256i needle = _mm256_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(cells + i)), needle);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        if (mask)
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + search_scalar(cells + i, n - i, value);
+}
+
+AVX2 static size_t mismatch_avx2(const Cell *a, const Cell *b, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                        _mm256_loadu_si256((const __m256i *)(b + i)));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq)) ^ 0xff;
+        if (mask)
+            return i + (size_t)__builtin_ctz((unsigned)mask);
+    }
+    return i + mismatch_scalar(a + i, b + i, n - i);
+}
+
+static const BulkKernels avx2 = {
+    "avx2", sum_avx2, min_avx2, max_avx2, search_avx2, mismatch_avx2
+};
+
+#endif
+
+const BulkKernels *bulk_kernels(BulkLevel level) {
+    switch (level) {
+        case BULK_SCALAR:
+            return &scalar;
+#ifdef BULK_X86
+        case BULK_SSE2:
+            return &sse2;
+        case BULK_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? &avx2 : NULL;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+static const BulkKernels *best = NULL;
+static pthread_once_t best_chosen = PTHREAD_ONCE_INIT;
+
+static void choose_best(void) {
+    for (int level = BULK_LEVELS - 1; !best; level--)
+        best = bulk_kernels((BulkLevel)level);
+}
+
+const BulkKernels *bulk(void) {
+    pthread_once(&best_chosen, choose_best);
+    return best;
+}
@@ -0,0 +1,37 @@
+#ifndef BULK_H
+#define BULK_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Bulk memory kernels for MOVE, CMOVE, FILL and the
+ *                  cell-array words, with SSE2/AVX2 versions picked at runtime
+ * License:         MIT
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Cell.h"
+
+typedef enum {
+    BULK_SCALAR,
+    BULK_SSE2,
+    BULK_AVX2,
+    BULK_LEVELS
+} BulkLevel;
+
+typedef struct {
+    const char *name;
+    Cell (*sum)(const Cell *cells, size_t n);
+    Cell (*min)(const Cell *cells, size_t n);
+    Cell (*max)(const Cell *cells, size_t n);
+    size_t (*search)(const Cell *cells, size_t n, Cell value);         /* n when absent */
+    size_t (*mismatch)(const Cell *a, const Cell *b, size_t n);        /* n when equal */
+} BulkKernels;
+
+const BulkKernels *bulk_kernels(BulkLevel level);     /* NULL when the CPU lacks it */
+const BulkKernels *bulk(void);                        /* best available */
+
+void bulk_copy(uint8_t *dest, const uint8_t *src, size_t n);
+void bulk_fill(uint8_t *dest, int value, size_t n);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef CELL_H
+#define CELL_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     The cell: 32 bits, or 64 with make CELL=64. A double
+ *                  cell (D+, M*, UM/MOD, D. ...) is the next size up.
+ * License:         MIT
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+
+#ifdef YAFI_CELL_64
+typedef int64_t Cell;
+typedef uint64_t UCell;
+typedef __int128 DCell;
+typedef unsigned __int128 UDCell;
+#define CELL_MIN    INT64_MIN
+#define CELL_MAX    INT64_MAX
+#define PRIdCELL    PRId64
+#else
+typedef int32_t Cell;
+typedef uint32_t UCell;
+typedef int64_t DCell;
+typedef uint64_t UDCell;
+#define CELL_MIN    INT32_MIN
+#define CELL_MAX    INT32_MAX
+#define PRIdCELL    PRId32
+#endif
+
+#define CELL_BITS   (8 * (int)sizeof(Cell))
+
+#endif
@@ -0,0 +1,302 @@
+#include "Compiler.h"
+#include "Dictionary.h"
+#include "Engine.h"
+#include "Peephole.h"
+#include "Lexer.h"
+#include "Vm.h"
+
+#define CODE_INITIAL 16
+
+static void emit(CodeBuffer *buffer, const DictEntry *entry, Cell value) {
+    if (buffer->length == buffer->capacity) {
+        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : CODE_INITIAL;
+        buffer->code = realloc(buffer->code, buffer->capacity * sizeof(Instr));
+        if (!buffer->code) {
+            const char *name = current_vm->compiler.name;
+            fprintf(stderr, "Out of memory compiling %s\n", name ? name : "top level");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Instr *instr = &buffer->code[buffer->length++];
+    instr->op = entry->opcode;
+    instr->in = entry->in;
+    instr->out = entry->out;
+    instr->value = value;
+    instr->entry = entry;
+}
+
+/* words go into the open definition, else into the recorded top level */
+static CodeBuffer *target(CompilerState *c) {
+    return c->name ? &c->definition : &c->toplevel;
+}
+
+/* runs the peephole pass over the code since the last branch or branch target */
+static void flush(CodeBuffer *buffer) {
+    if (buffer->length > buffer->sealed)
+        buffer->length = buffer->sealed + peephole(buffer->code + buffer->sealed,
+                                                   buffer->length - buffer->sealed);
+}
+
+bool is_compiling(void) {
+    return current_vm->compiler.name != NULL;
+}
+
+bool is_recording(void) {
+    return current_vm->compiler.recording;
+}
+
+/* word points at the name token in the input; names are kept upper-case */
+void compile_begin(const char *word, int length) {
+    CompilerState *c = &current_vm->compiler;
+    char *name = malloc(length + 1);
+    if (!name) {
+        fprintf(stderr, "Out of memory compiling %.*s\n", length, word);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < length; i++)
+        name[i] = fold_case(word[i]);
+    name[length] = '\0';
+    c->name = name;
+    c->definition.code = NULL;
+    c->definition.length = 0;
+    c->definition.capacity = 0;
+    c->definition.sealed = 0;
+    c->control_depth = 0;
+}
+
+static int open_loops(const CompilerState *c) {
+    int loops = 0;
+    for (int i = 0; i < c->control_depth; i++)
+        loops += (c->control[i].word == CONTROL_DO);
+    return loops;
+}
+
+/* EXIT inside a definition returns from it, as in Forth-79, dropping the loops it is in */
+void compile_entry(const DictEntry *entry) {
+    CompilerState *c = &current_vm->compiler;
+    if (c->name && entry->type == OP && entry->func.fp == op_exit) {
+        int loops = open_loops(c);
+        if (loops > 0)
+            emit(target(c), &word_unloop, loops);
+        emit(target(c), &word_ret, 0);
+    } else {
+        emit(target(c), entry, 0);
+    }
+}
+
+void compile_literal(Cell value) {
+    emit(target(&current_vm->compiler), &word_lit, value);
+}
+
+static const char *control_names[] = {
+    [CONTROL_IF] = IF, [CONTROL_ELSE] = ELSE, [CONTROL_THEN] = THEN,
+    [CONTROL_BEGIN] = BEGIN, [CONTROL_UNTIL] = UNTIL, [CONTROL_WHILE] = WHILE,
+    [CONTROL_REPEAT] = REPEAT, [CONTROL_AGAIN] = AGAIN,
+    [CONTROL_DO] = DO, [CONTROL_LOOP] = LOOP, [CONTROL_PLUS_LOOP] = PLOOP,
+    [CONTROL_I] = INDEX_I, [CONTROL_J] = INDEX_J, [CONTROL_LEAVE] = LEAVE,
+};
+
+/*
+ *  A branch or branch target ends a stretch of code for the peephole pass,
+ *  so no rewrite moves an instruction a branch points at. Returns the
+ *  index of the emitted word. A conditional branch takes over a 0= just
+ *  before it by branching on a true flag instead.
+ */
+static int emit_control(CodeBuffer *buffer, const DictEntry *entry) {
+    flush(buffer);
+    if (entry == &word_zero_branch && buffer->length > buffer->sealed
+            && buffer->code[buffer->length - 1].op == OPC_ZERO_EQUAL) {
+        buffer->length--;
+        entry = &word_true_branch;
+        current_vm->fusions[FUSE_ZERO_BRANCH]++;
+    }
+    emit(buffer, entry, 0);
+    buffer->sealed = buffer->length;
+    return buffer->length - 1;
+}
+
+/* the index of the next instruction, as a branch target */
+static int mark(CodeBuffer *buffer) {
+    flush(buffer);
+    buffer->sealed = buffer->length;
+    return buffer->length;
+}
+
+static void resolve(CodeBuffer *buffer, int branch, int target) {
+    buffer->code[branch].value = target - (branch + 1);
+}
+
+static void open_control(CompilerState *c, ControlWord word, int at) {
+    if (c->control_depth == CONTROL_DEPTH) {
+        fprintf(current_vm->out, "Control structures nested too deep in %s\n", c->name);
+        compile_abort();
+        return;
+    }
+    c->control[c->control_depth].word = word;
+    c->control[c->control_depth].at = at;
+    c->control_depth++;
+}
+
+/* the innermost structure's index when it was opened by one of the given words, else -1 */
+static int close_control(CompilerState *c, ControlWord word, ControlWord opened, ControlWord also) {
+    const Control *top = c->control_depth ? &c->control[c->control_depth - 1] : NULL;
+    if (!top || (top->word != opened && top->word != also)) {
+        fprintf(current_vm->out, "%s without %s in %s\n", control_names[word], control_names[opened], c->name);
+        compile_abort();
+        return -1;
+    }
+    c->control_depth--;
+    return top->at;
+}
+
+/* IF ... REPEAT run while compiling and only there; I, J and LEAVE need their loops in the same definition */
+void compile_control(ControlWord word) {
+    CompilerState *c = &current_vm->compiler;
+    CodeBuffer *code = &c->definition;
+    int origin;
+    int destination;
+
+    if (!c->name) {
+        fprintf(current_vm->out, "%s outside a definition\n", control_names[word]);
+        return;
+    }
+    switch (word) {
+        case CONTROL_IF:
+            open_control(c, CONTROL_IF, emit_control(code, &word_zero_branch));
+            break;
+        case CONTROL_ELSE:
+            if ((origin = close_control(c, word, CONTROL_IF, CONTROL_IF)) < 0)
+                return;
+            open_control(c, CONTROL_ELSE, emit_control(code, &word_branch));
+            resolve(code, origin, mark(code));
+            break;
+        case CONTROL_THEN:
+            if ((origin = close_control(c, word, CONTROL_IF, CONTROL_ELSE)) < 0)
+                return;
+            resolve(code, origin, mark(code));
+            break;
+        case CONTROL_BEGIN:
+            open_control(c, CONTROL_BEGIN, mark(code));
+            break;
+        case CONTROL_UNTIL:
+        case CONTROL_AGAIN:
+            if ((destination = close_control(c, word, CONTROL_BEGIN, CONTROL_BEGIN)) < 0)
+                return;
+            origin = emit_control(code, (word == CONTROL_UNTIL) ? &word_zero_branch : &word_branch);
+            resolve(code, origin, destination);
+            break;
+        case CONTROL_WHILE:
+            if (close_control(c, word, CONTROL_BEGIN, CONTROL_BEGIN) < 0)
+                return;
+            c->control_depth++;     /* BEGIN stays open until REPEAT */
+            open_control(c, CONTROL_WHILE, emit_control(code, &word_zero_branch));
+            break;
+        case CONTROL_REPEAT:
+            if ((origin = close_control(c, word, CONTROL_WHILE, CONTROL_WHILE)) < 0)
+                return;
+            destination = c->control[--c->control_depth].at;
+            resolve(code, emit_control(code, &word_branch), destination);
+            resolve(code, origin, mark(code));
+            break;
+        case CONTROL_DO:
+            emit_control(code, &word_do);
+            open_control(c, CONTROL_DO, mark(code));
+            break;
+        case CONTROL_LOOP:
+        case CONTROL_PLUS_LOOP:
+            if ((destination = close_control(c, word, CONTROL_DO, CONTROL_DO)) < 0)
+                return;
+            origin = emit_control(code, (word == CONTROL_LOOP) ? &word_loop : &word_plus_loop);
+            resolve(code, origin, destination);
+            break;
+        case CONTROL_I:
+        case CONTROL_J:
+        case CONTROL_LEAVE:
+            if (open_loops(c) < ((word == CONTROL_J) ? 2 : 1)) {
+                fprintf(current_vm->out, "%s outside a DO loop in %s\n", control_names[word], c->name);
+                compile_abort();
+                return;
+            }
+            emit(code, (word == CONTROL_I) ? &word_i : (word == CONTROL_J) ? &word_j : &word_leave, 0);
+            break;
+    }
+}
+
+/* the new word only becomes visible once its body is complete */
+void compile_end(void) {
+    CompilerState *c = &current_vm->compiler;
+    if (c->control_depth > 0) {
+        fprintf(current_vm->out, "Unresolved %s in %s\n",
+                control_names[c->control[c->control_depth - 1].word], c->name);
+        compile_abort();
+        return;
+    }
+    flush(&c->definition);
+    emit(&c->definition, &word_ret, 0);
+
+    DictEntry *entry = malloc(sizeof(DictEntry));
+    Definition *colon = malloc(sizeof(Definition));
+    if (!entry || !colon) {
+        fprintf(stderr, "Out of memory compiling %s\n", c->name);
+        exit(EXIT_FAILURE);
+    }
+    entry->word = c->name;
+    entry->type = OP_COLON;
+    entry->opcode = OPC_CALL;
+    entry->in = 0;
+    entry->out = 0;
+    colon->body = realloc(c->definition.code, c->definition.length * sizeof(Instr));
+    colon->length = c->definition.length;
+    colon->calls = 0;
+    colon->native = NULL;
+    entry->func.colon = colon;
+    add_entry(entry);
+
+    c->name = NULL;
+    c->definition.code = NULL;
+}
+
+void compile_abort(void) {
+    CompilerState *c = &current_vm->compiler;
+    free(c->name);
+    free(c->definition.code);
+    c->name = NULL;
+    c->definition.code = NULL;
+    c->control_depth = 0;
+}
+
+void record_begin(void) {
+    CompilerState *c = &current_vm->compiler;
+    c->recording = true;
+    c->toplevel.code = NULL;
+    c->toplevel.length = 0;
+    c->toplevel.capacity = 0;
+    c->toplevel.sealed = 0;
+}
+
+/* hands the recorded top level over as a definition body ending in (RET) */
+Definition *record_end(void) {
+    CompilerState *c = &current_vm->compiler;
+    Definition *colon = malloc(sizeof(Definition));
+    if (!colon) {
+        fprintf(stderr, "Out of memory compiling top level\n");
+        exit(EXIT_FAILURE);
+    }
+    flush(&c->toplevel);
+    emit(&c->toplevel, &word_ret, 0);
+    colon->body = c->toplevel.code;
+    colon->length = c->toplevel.length;
+    colon->calls = 0;
+    colon->native = NULL;
+
+    c->recording = false;
+    c->toplevel.code = NULL;
+    return colon;
+}
+
+void release_compiler(CompilerState *compiler) {
+    free(compiler->name);
+    free(compiler->definition.code);
+    free(compiler->toplevel.code);
+    memset(compiler, 0, sizeof(*compiler));
+}
@@ -0,0 +1,59 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Compiles colon definitions into threaded code
+ * License:         MIT
+ */
+
+#include "forth.h"
+
+#define CONTROL_DEPTH 32
+
+/* code before sealed has been through the peephole pass and is final, so branches can point into it */
+typedef struct {
+    Instr *code;
+    int length;
+    int capacity;
+    int sealed;
+} CodeBuffer;
+
+/* the control-flow words, all compiled by compile_control() */
+typedef enum {
+    CONTROL_IF, CONTROL_ELSE, CONTROL_THEN,
+    CONTROL_BEGIN, CONTROL_UNTIL, CONTROL_WHILE, CONTROL_REPEAT, CONTROL_AGAIN,
+    CONTROL_DO, CONTROL_LOOP, CONTROL_PLUS_LOOP, CONTROL_I, CONTROL_J, CONTROL_LEAVE
+} ControlWord;
+
+/* an open structure: the branch awaiting its target (IF, ELSE, WHILE) or the target of one to come (BEGIN, DO) */
+typedef struct {
+    ControlWord word;
+    int at;
+} Control;
+
+/* per VM: the open definition, and the top level recorded for yafi-aot instead of being run */
+typedef struct {
+    char *name;
+    CodeBuffer definition;
+    Control control[CONTROL_DEPTH];
+    int control_depth;
+    bool recording;
+    CodeBuffer toplevel;
+} CompilerState;
+
+void release_compiler(CompilerState *compiler);
+
+bool is_compiling(void);
+void compile_begin(const char *name, int length);
+void compile_entry(const DictEntry *entry);
+void compile_literal(Cell value);
+void compile_end(void);
+void compile_abort(void);
+void compile_control(ControlWord word);
+
+bool is_recording(void);
+void record_begin(void);
+Definition *record_end(void);
+
+#endif
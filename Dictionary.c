@@ -0,0 +1,188 @@
+#include "Dictionary.h"
+#include "Vm.h"
+
+/*
+ *  Built-in words live in a perfect hash: every entry of dictionary[] owns a
+ *  distinct slot, so a lookup is one hash and at most one strcmp, hit or miss.
+ *  BUILTIN_SEED is precomputed for the current table; when the table changes
+ *  and the seed no longer separates it, init_dictionary() searches a new one.
+ *  The built-ins are shared by every VM and only written by init_dictionary();
+ *  words added at runtime go into the running VM's own WordTable.
+ */
+#define BUILTIN_BITS    10
+#define BUILTIN_SLOTS   (1u << BUILTIN_BITS)
+#define BUILTIN_SEED    132u
+
+/* runtime table starts small and doubles at 3/4 load */
+#define USER_INITIAL    64
+
+static DictEntry *builtin_slots[BUILTIN_SLOTS];
+static uint32_t builtin_seed = BUILTIN_SEED;
+
+/* FNV-1a, case-folded the same way the lexer hashes tokens */
+uint32_t hash_word(const char *word) {
+    uint32_t h = HASH_INIT;
+    for (; *word; word++)
+        h = hash_step(h, *word);
+    return h;
+}
+
+/* names are stored upper-case; the token may be in any case and is not NUL-terminated */
+static inline bool same_word(const char *name, const char *word, int length) {
+    for (int i = 0; i < length; i++) {
+        if (name[i] != fold_case(word[i]))
+            return false;
+    }
+    return name[length] == '\0';
+}
+
+static inline uint32_t builtin_slot(uint32_t h, uint32_t seed) {
+    return ((h ^ seed) * 2654435761u) >> (32 - BUILTIN_BITS);
+}
+
+static bool try_builtin_seed(uint32_t seed) {
+    memset(builtin_slots, 0, sizeof(builtin_slots));
+    for (int i = 0; dictionary[i].word != NULL; i++) {
+        uint32_t slot = builtin_slot(hash_word(dictionary[i].word), seed);
+        if (builtin_slots[slot] != NULL)
+            return false;
+        builtin_slots[slot] = &dictionary[i];
+    }
+    return true;
+}
+
+static void user_grow(WordTable *words) {
+    uint32_t capacity = words->capacity ? words->capacity * 2 : USER_INITIAL;
+    DictEntry **slots = calloc(capacity, sizeof(DictEntry *));
+    uint32_t *hashes = calloc(capacity, sizeof(uint32_t));
+    if (!slots || !hashes) {
+        fprintf(stderr, "Out of memory growing dictionary\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < words->capacity; i++) {
+        if (words->slots[i] == NULL)
+            continue;
+        uint32_t j = words->hashes[i] & (capacity - 1);
+        while (slots[j] != NULL)
+            j = (j + 1) & (capacity - 1);
+        slots[j] = words->slots[i];
+        hashes[j] = words->hashes[i];
+    }
+    free(words->slots);
+    free(words->hashes);
+    words->slots = slots;
+    words->hashes = hashes;
+    words->capacity = capacity;
+}
+
+/* old code may still call a shadowed entry, so entries are only freed with the VM */
+static void remember(WordTable *words, DictEntry *entry) {
+    if (words->added_count == words->added_capacity) {
+        uint32_t capacity = words->added_capacity ? words->added_capacity * 2 : USER_INITIAL;
+        DictEntry **added = realloc(words->added, capacity * sizeof(DictEntry *));
+        if (!added) {
+            fprintf(stderr, "Out of memory growing dictionary\n");
+            exit(EXIT_FAILURE);
+        }
+        words->added = added;
+        words->added_capacity = capacity;
+    }
+    words->added[words->added_count++] = entry;
+}
+
+void init_dictionary(void) {
+    if (try_builtin_seed(builtin_seed))
+        return;
+    for (builtin_seed = 1; !try_builtin_seed(builtin_seed); builtin_seed++)
+        ;
+}
+
+/* a redefinition replaces the visible entry; code compiled against the old one keeps it */
+void add_entry(DictEntry *entry) {
+    WordTable *words = &current_vm->words;
+    remember(words, entry);
+    if ((words->count + 1) * 4 > words->capacity * 3)
+        user_grow(words);
+    uint32_t h = hash_word(entry->word);
+    uint32_t i = h & (words->capacity - 1);
+    while (words->slots[i] != NULL) {
+        if (words->hashes[i] == h && strcmp(words->slots[i]->word, entry->word) == 0) {
+            words->slots[i] = entry;
+            return;
+        }
+        i = (i + 1) & (words->capacity - 1);
+    }
+    words->slots[i] = entry;
+    words->hashes[i] = h;
+    words->count++;
+}
+
+/*
+ *  LOAD-IMAGE: no word stays visible, and none is saved with the next image,
+ *  but the word that ran LOAD-IMAGE may be one of them and is still running.
+ */
+void hide_words(WordTable *words) {
+    if (words->capacity)
+        memset(words->slots, 0, words->capacity * sizeof(DictEntry *));
+    words->count = 0;
+
+    DictEntry **hidden = realloc(words->hidden, (words->hidden_count + words->added_count + 1) * sizeof(DictEntry *));
+    if (!hidden) {
+        fprintf(stderr, "Out of memory growing dictionary\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(hidden + words->hidden_count, words->added, words->added_count * sizeof(DictEntry *));
+    words->hidden = hidden;
+    words->hidden_count += words->added_count;
+    words->added_count = 0;
+}
+
+/* colon definitions own their name and body */
+static void release_entries(DictEntry **entries, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        DictEntry *entry = entries[i];
+        if (entry->type == OP_COLON) {
+            free((void *)entry->func.colon->native);
+            free(entry->func.colon->body);
+            free(entry->func.colon);
+        }
+        free((char *)entry->word);
+        free(entry);
+    }
+    free(entries);
+}
+
+void release_words(WordTable *words) {
+    release_entries(words->added, words->added_count);
+    release_entries(words->hidden, words->hidden_count);
+    free(words->slots);
+    free(words->hashes);
+    memset(words, 0, sizeof(*words));
+}
+
+/* words added at runtime shadow the built-ins */
+static DictEntry *lookup(const char *word, int length, uint32_t h) {
+    const WordTable *words = &current_vm->words;
+    if (words->count) {
+        uint32_t i = h & (words->capacity - 1);
+        while (words->slots[i] != NULL) {
+            if (words->hashes[i] == h && same_word(words->slots[i]->word, word, length))
+                return words->slots[i];
+            i = (i + 1) & (words->capacity - 1);
+        }
+    }
+
+    DictEntry *entry = builtin_slots[builtin_slot(h, builtin_seed)];
+    if (entry && same_word(entry->word, word, length))
+        return entry;
+    return NULL;
+}
+
+DictEntry *find_entry(const char *word) {
+    return lookup(word, (int)strlen(word), hash_word(word));
+}
+
+/* the lexer has already hashed the token */
+DictEntry *find_token(const Token *token) {
+    return lookup(token->start, token->length, token->hash);
+}
@@ -0,0 +1,37 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Dictionary index: perfect hash over the built-in table,
+ *                  growable hash table for words added at runtime
+ * License:         MIT
+ */
+
+#include <stdint.h>
+#include "forth.h"
+#include "Lexer.h"
+
+/* words defined at runtime: one table per VM, over the shared built-ins */
+typedef struct {
+    DictEntry **slots;
+    uint32_t *hashes;
+    uint32_t capacity;
+    uint32_t count;
+    DictEntry **added;      /* every entry added since the last LOAD-IMAGE, shadowed ones too */
+    uint32_t added_count;
+    uint32_t added_capacity;
+    DictEntry **hidden;     /* added before a LOAD-IMAGE; only freed with the VM */
+    uint32_t hidden_count;
+} WordTable;
+
+void init_dictionary(void);
+void release_words(WordTable *words);
+DictEntry *find_entry(const char *word);
+DictEntry *find_token(const Token *token);
+void add_entry(DictEntry *entry);
+void hide_words(WordTable *words);
+
+uint32_t hash_word(const char *word);
+
+#endif
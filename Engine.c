@@ -0,0 +1,635 @@
+#include "Engine.h"
+#include "Jit.h"
+#include "Vm.h"
+
+const DictEntry word_lit = { "(LIT)", OP_LIT, {NULL}, OPC_LIT, 0, 1 };
+const DictEntry word_ret = { "(RET)", OP_RET, {NULL}, OPC_RET, 0, 0 };
+
+const DictEntry word_branch      = { "(BRANCH)",     OP_CONTROL, {NULL}, OPC_BRANCH,      0, 0 };
+const DictEntry word_zero_branch = { "(0BRANCH)",    OP_CONTROL, {NULL}, OPC_ZERO_BRANCH, 1, 0 };
+const DictEntry word_true_branch = { "0= (0BRANCH)", OP_CONTROL, {NULL}, OPC_TRUE_BRANCH, 1, 0 };
+const DictEntry word_do          = { "(DO)",         OP_CONTROL, {NULL}, OPC_DO,          2, 0 };
+const DictEntry word_loop        = { "(LOOP)",       OP_CONTROL, {NULL}, OPC_LOOP,        0, 0 };
+const DictEntry word_plus_loop   = { "(+LOOP)",      OP_CONTROL, {NULL}, OPC_PLUS_LOOP,   1, 0 };
+const DictEntry word_i           = { INDEX_I,        OP_CONTROL, {NULL}, OPC_I,           0, 1 };
+const DictEntry word_j           = { INDEX_J,        OP_CONTROL, {NULL}, OPC_J,           0, 1 };
+const DictEntry word_leave       = { LEAVE,          OP_CONTROL, {NULL}, OPC_LEAVE,       0, 0 };
+const DictEntry word_unloop      = { "(UNLOOP)",     OP_CONTROL, {NULL}, OPC_UNLOOP,      0, 0 };
+
+/* make PROFILE=yes: both engines step the running VM's profile; otherwise nothing is compiled in */
+#ifdef YAFI_PROFILE
+#define PROFILE_STEP(instr) do { \
+                        Profile *profile = current_vm->profile; \
+                        if (profile && profile->on) profile_step(profile, instr); \
+                    } while (0)
+#define PROFILE_RETURN() do { \
+                        Profile *profile = current_vm->profile; \
+                        if (profile && profile->on) profile_return(profile); \
+                    } while (0)
+#else
+#define PROFILE_STEP(instr)
+#define PROFILE_RETURN()
+#endif
+
+#if defined(__GNUC__) && !defined(YAFI_SWITCH_DISPATCH)
+
+/*
+ *  Direct dispatch: every opcode has its own label and each handler ends in
+ *  its own indirect jump to the next one (NEXT), so there is no shared
+ *  switch, no OpType test and no call through the func union.
+ *
+ *  The top of the data stack lives in the local tos and sp points one past
+ *  it, so stack->data[depth - 1] is stale while the engine runs. NEXT checks
+ *  the word's declared stack effect once; handlers then move cells without
+ *  bounds checks. Words without an inline handler spill tos back into the
+ *  Stack, call their op_* function and reload.
+ *
+ *  A task runs with resume set: its calls and loops live there, and PAUSE
+ *  saves the other registers and returns. Otherwise PAUSE lets the other
+ *  tasks run a round and carries on.
+ */
+static void run(const Instr *ip, Stack *stack, Stack *return_stack, Cell *memory, Resume *resume) {
+    static const void *handlers[OPCODE_COUNT] = {
+        [OPC_LIT]               = &&do_lit,
+        [OPC_RET]               = &&do_ret,
+        [OPC_CALL]              = &&do_call,
+        [OPC_LESS_THAN]         = &&do_less_than,
+        [OPC_EQUAL]             = &&do_equal,
+        [OPC_GREATER_THAN]      = &&do_greater_than,
+        [OPC_ZERO_LESS]         = &&do_zero_less,
+        [OPC_ZERO_EQUAL]        = &&do_zero_equal,
+        [OPC_ZERO_GREATER]      = &&do_zero_greater,
+        [OPC_D_LESS]            = &&do_d_less,
+        [OPC_NOT]               = &&do_not,
+        [OPC_CR]                = &&do_cr,
+        [OPC_EMIT]              = &&do_emit,
+        [OPC_SPACE]             = &&do_space,
+        [OPC_SPACES]            = &&do_spaces,
+        [OPC_TYPE]              = &&do_type,
+        [OPC_COUNT]             = &&do_count,
+        [OPC_DOT_QUOTE]         = &&do_dot_quote,
+        [OPC_S_QUOTE]           = &&do_s_quote,
+        [OPC_ADD]               = &&do_add,
+        [OPC_SUB]               = &&do_sub,
+        [OPC_MUL]               = &&do_mul,
+        [OPC_DIV]               = &&do_div,
+        [OPC_MOD]               = &&do_mod,
+        [OPC_DIVMOD]            = &&do_divmod,
+        [OPC_ONE_PLUS]          = &&do_one_plus,
+        [OPC_ONE_MINUS]         = &&do_one_minus,
+        [OPC_TWO_PLUS]          = &&do_two_plus,
+        [OPC_TWO_MINUS]         = &&do_two_minus,
+        [OPC_D_PLUS]            = &&do_d_plus,
+        [OPC_MAX]               = &&do_max,
+        [OPC_MIN]               = &&do_min,
+        [OPC_ABS]               = &&do_abs,
+        [OPC_NEGATE]            = &&do_negate,
+        [OPC_DNEGATE]           = &&do_dnegate,
+        [OPC_AND]               = &&do_and,
+        [OPC_OR]                = &&do_or,
+        [OPC_XOR]               = &&do_xor,
+        [OPC_M_STAR]            = &&do_m_star,
+        [OPC_UM_STAR]           = &&do_um_star,
+        [OPC_UM_SLASH_MOD]      = &&do_um_slash_mod,
+        [OPC_STAR_SLASH]        = &&do_star_slash,
+        [OPC_STAR_SLASH_MOD]    = &&do_star_slash_mod,
+        [OPC_FETCH]             = &&do_fetch,
+        [OPC_STORE]             = &&do_store,
+        [OPC_CFETCH]            = &&do_cfetch,
+        [OPC_CSTORE]            = &&do_cstore,
+        [OPC_QUESTION]          = &&do_question,
+        [OPC_MOVE]              = &&do_move,
+        [OPC_CMOVE]             = &&do_cmove,
+        [OPC_FILL]              = &&do_fill,
+        [OPC_CELLS_SUM]         = &&do_cells_sum,
+        [OPC_CELLS_MIN]         = &&do_cells_min,
+        [OPC_CELLS_MAX]         = &&do_cells_max,
+        [OPC_CELLS_COMPARE]     = &&do_cells_compare,
+        [OPC_CELLS_SEARCH]      = &&do_cells_search,
+        [OPC_DUP]               = &&do_dup,
+        [OPC_DROP]              = &&do_drop,
+        [OPC_SWAP]              = &&do_swap,
+        [OPC_OVER]              = &&do_over,
+        [OPC_ROT]               = &&do_rot,
+        [OPC_PICK]              = &&do_pick,
+        [OPC_ROLL]              = &&do_roll,
+        [OPC_DEPTH]             = &&do_depth,
+        [OPC_TO_R]              = &&do_to_r,
+        [OPC_R_FROM]            = &&do_r_from,
+        [OPC_R_FETCH]           = &&do_r_fetch,
+        [OPC_PRINT]             = &&do_print,
+        [OPC_D_PRINT]           = &&do_d_print,
+        [OPC_BASE]              = &&do_base,
+        [OPC_DECIMAL]           = &&do_decimal,
+        [OPC_HEX]               = &&do_hex,
+        [OPC_BINARY]            = &&do_binary,
+        [OPC_COLON]             = &&do_colon,
+        [OPC_SEMICOLON]         = &&do_semicolon,
+        [OPC_EXIT]              = &&do_exit,
+        [OPC_CONTROL]           = &&do_control,
+        [OPC_BRANCH]            = &&do_branch,
+        [OPC_ZERO_BRANCH]       = &&do_zero_branch,
+        [OPC_TRUE_BRANCH]       = &&do_true_branch,
+        [OPC_DO]                = &&do_do,
+        [OPC_LOOP]              = &&do_loop,
+        [OPC_PLUS_LOOP]         = &&do_plus_loop,
+        [OPC_I]                 = &&do_i,
+        [OPC_J]                 = &&do_j,
+        [OPC_LEAVE]             = &&do_leave,
+        [OPC_UNLOOP]            = &&do_unloop,
+        [OPC_FUSIONS]           = &&do_fusions,
+        [OPC_TICK]              = &&do_tick,
+        [OPC_EXECUTE]           = &&do_execute,
+        [OPC_CATCH]             = &&do_catch,
+        [OPC_THROW]             = &&do_throw,
+        [OPC_PAR_MAP]           = &&do_par_map,
+        [OPC_PAR_REDUCE]        = &&do_par_reduce,
+        [OPC_FLUSH]             = &&do_flush,
+        [OPC_PROFILE_ON]        = &&do_profile_on,
+        [OPC_PROFILE_OFF]       = &&do_profile_off,
+        [OPC_PROFILE_DUMP]      = &&do_profile_dump,
+        [OPC_SAVE_IMAGE]        = &&do_save_image,
+        [OPC_LOAD_IMAGE]        = &&do_load_image,
+        [OPC_SPAWN]             = &&do_spawn,
+        [OPC_PAUSE]             = &&do_pause,
+        [OPC_STOP]              = &&do_stop,
+        [OPC_TASKS]             = &&do_tasks,
+        [OPC_USER_AREA]         = &&do_user_area,
+        [OPC_NATIVE]            = &&do_native,
+        [OPC_DUP_ADD]           = &&do_dup_add,
+        [OPC_NIP]               = &&do_nip,
+        [OPC_TWO_DUP]           = &&do_two_dup,
+        [OPC_LIT_ADD]           = &&do_lit_add,
+        [OPC_LIT_FETCH]         = &&do_lit_fetch,
+        [OPC_LIT_STORE]         = &&do_lit_store,
+    };
+    const Instr *own_calls[CALL_DEPTH];
+    Loop own_loops[LOOP_DEPTH];
+    const Instr **calls = own_calls;
+    Loop *loops = own_loops;
+    int rp = 0;
+    int lp = 0;
+    Cell index = 0;
+    Cell limit = 0;
+    const Instr *instr;
+    Definition *callee;
+    Cell * const base = stack->data;
+    const unsigned cells = (unsigned)memory_cells;
+#ifdef YAFI_JIT
+    const bool count_calls = !jit_held;     /* PAR-MAP threads share the definitions */
+#endif
+    Cell *sp = base + stack->top;
+    Cell tos;
+    Cell a;
+
+/* cell under the cached tos; aliases data[0] while the stack is empty */
+#define UNDER       sp[-(sp > base)]
+#define SPILL()     do { UNDER = tos; stack->top = sp - base; } while (0)
+#define RELOAD()    do { sp = base + stack->top; tos = UNDER; } while (0)
+#define PUSH(x)     do { UNDER = tos; sp++; tos = (x); } while (0)
+#define POP()       do { sp--; tos = UNDER; } while (0)
+#define BINARY(e)   do { a = sp[-2]; tos = (e); sp--; } while (0)
+#define COLD(call)  do { SPILL(); call; RELOAD(); } while (0)
+#define UNLOOP(n)   do { lp -= (n); index = loops[lp].index; limit = loops[lp].limit; } while (0)
+#define NEXT        do { \
+                        instr = ip++; \
+                        PROFILE_STEP(instr); \
+                        if ((unsigned)((sp - base) - instr->in) > (unsigned)(STACK_SIZE - instr->out)) \
+                            goto stack_fault; \
+                        goto *handlers[instr->op]; \
+                    } while (0)
+
+    if (resume) {
+        calls = resume->calls;
+        loops = resume->loops;
+        rp = resume->rp;
+        lp = resume->lp;
+        index = resume->index;
+        limit = resume->limit;
+    }
+    tos = UNDER;
+    NEXT;
+
+stack_fault:
+    SPILL();
+    if (sp - base < instr->in)
+        vm_throw(THROW_STACK_UNDERFLOW, "Stack underflow for %s!\n", instr->entry->word);
+    vm_throw(THROW_STACK_OVERFLOW, "Stack overflow for %s!\n", instr->entry->word);
+
+do_lit:             PUSH(instr->value); NEXT;
+do_ret:
+    if (rp == 0) {
+        SPILL();
+        if (resume)
+            resume->ip = NULL;
+        return;
+    }
+    ip = calls[--rp];
+    PROFILE_RETURN();
+    NEXT;
+do_call:
+    callee = instr->entry->func.colon;
+#ifdef YAFI_JIT
+    if (callee->native) {
+        const struct Native *native = callee->native;
+        a = sp - base;
+        if (a >= native->in && a + native->growth <= STACK_SIZE) {
+            JitResult result = native->fn(sp, tos, memory);
+            if (result.sp == NULL) {
+                SPILL();
+                jit_fault(result.tos);
+            }
+            sp = result.sp;
+            tos = (Cell)result.tos;
+            NEXT;
+        }
+    } else if (count_calls && ++callee->calls == JIT_THRESHOLD) {
+        jit_compile(instr->entry);
+    }
+#endif
+    if (rp == CALL_DEPTH) {
+        vm_throw(THROW_RSTACK_OVERFLOW, "Call stack overflow in %s\n", instr->entry->word);
+    }
+    calls[rp++] = ip;
+    ip = callee->body;
+    NEXT;
+
+/* COMPUTATION */
+do_less_than:       BINARY((a < tos) ? -1 : 0); NEXT;
+do_equal:           BINARY((a == tos) ? -1 : 0); NEXT;
+do_greater_than:    BINARY((a > tos) ? -1 : 0); NEXT;
+do_zero_less:       tos = (tos < 0) ? -1 : 0; NEXT;
+do_zero_equal:      tos = (tos == 0) ? -1 : 0; NEXT;
+do_zero_greater:    tos = (tos > 0) ? -1 : 0; NEXT;
+do_d_less:          COLD(op_d_less(stack)); NEXT;
+do_not:             tos = ~tos; NEXT;
+
+/* IO-CHARACTERS */
+do_cr:              op_cr(); NEXT;
+do_emit:            COLD(op_emit(stack)); NEXT;
+do_space:           op_space(); NEXT;
+do_spaces:          COLD(op_spaces(stack)); NEXT;
+do_type:            COLD(op_type(stack, (uint8_t *)memory)); NEXT;
+do_count:           COLD(op_count(stack, (uint8_t *)memory)); NEXT;
+do_dot_quote:       COLD(op_dot_quote()); NEXT;
+do_s_quote:         COLD(op_s_quote()); NEXT;
+
+/* LOGICAL */
+do_add:             BINARY(a + tos); NEXT;
+do_sub:             BINARY(a - tos); NEXT;
+do_mul:             BINARY(a * tos); NEXT;
+do_div:
+    if (tos == 0) {
+        vm_throw(THROW_DIVISION_BY_ZERO, "Division by zero!\n");
+    }
+    if (tos == -1 && sp[-2] == CELL_MIN) {
+        vm_throw(THROW_RESULT_OUT_OF_RANGE, "Division overflow!\n");
+    }
+    BINARY(a / tos);
+    NEXT;
+do_mod:
+    if (tos == 0) {
+        vm_throw(THROW_DIVISION_BY_ZERO, "Modulo by zero!\n");
+    }
+    if (tos == -1 && sp[-2] == CELL_MIN) {
+        vm_throw(THROW_RESULT_OUT_OF_RANGE, "Modulo overflow!\n");
+    }
+    BINARY(a % tos);
+    NEXT;
+do_divmod:
+    if (tos == 0) {
+        vm_throw(THROW_DIVISION_BY_ZERO, "/MOD error: Division by zero\n");
+    }
+    if (tos == -1 && sp[-2] == CELL_MIN) {
+        vm_throw(THROW_RESULT_OUT_OF_RANGE, "/MOD error: Result out of range\n");
+    }
+    a = sp[-2];
+    sp[-2] = a % tos;
+    tos = a / tos;
+    NEXT;
+do_one_plus:        tos += 1; NEXT;
+do_one_minus:       tos -= 1; NEXT;
+do_two_plus:        tos += 2; NEXT;
+do_two_minus:       tos -= 2; NEXT;
+do_d_plus:          COLD(op_d_plus(stack)); NEXT;
+do_max:             BINARY((a > tos) ? a : tos); NEXT;
+do_min:             BINARY((a < tos) ? a : tos); NEXT;
+do_abs:             tos = (tos < 0) ? -tos : tos; NEXT;
+do_negate:          tos = -tos; NEXT;
+do_dnegate:         COLD(op_dnegate(stack)); NEXT;
+do_and:             BINARY(a & tos); NEXT;
+do_or:              BINARY(a | tos); NEXT;
+do_xor:             BINARY(a ^ tos); NEXT;
+do_m_star:          COLD(op_m_star(stack)); NEXT;
+do_um_star:         COLD(op_um_star(stack)); NEXT;
+do_um_slash_mod:    COLD(op_um_slash_mod(stack)); NEXT;
+do_star_slash:      COLD(op_star_slash(stack)); NEXT;
+do_star_slash_mod:  COLD(op_star_slash_mod(stack)); NEXT;
+
+/* MEMORY */
+do_fetch:
+    if (OUT_OF_BOUNDS(tos, cells)) {
+        vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds at @\n");
+    }
+    tos = memory[tos];
+    NEXT;
+do_store:
+    if (OUT_OF_BOUNDS(tos, cells)) {
+        vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds at !\n");
+    }
+    memory[tos] = sp[-2];
+    sp -= 2;
+    tos = UNDER;
+    NEXT;
+do_cfetch:
+    if (BYTE_OUT_OF_BOUNDS(tos, cells)) {
+        vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds in C@\n");
+    }
+    tos = ((uint8_t *)memory)[tos];
+    NEXT;
+do_cstore:
+    if (BYTE_OUT_OF_BOUNDS(tos, cells)) {
+        vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds in C!\n");
+    }
+    ((uint8_t *)memory)[tos] = (uint8_t)(sp[-2] & 0xFF);
+    sp -= 2;
+    tos = UNDER;
+    NEXT;
+do_question:        COLD(op_question(stack, memory)); NEXT;
+do_move:            COLD(op_move(stack, (uint8_t *)memory)); NEXT;
+do_cmove:           COLD(op_cmove(stack, (uint8_t *)memory)); NEXT;
+do_fill:            COLD(op_fill(stack, (uint8_t *)memory)); NEXT;
+do_cells_sum:       COLD(op_cells_sum(stack, memory)); NEXT;
+do_cells_min:       COLD(op_cells_min(stack, memory)); NEXT;
+do_cells_max:       COLD(op_cells_max(stack, memory)); NEXT;
+do_cells_compare:   COLD(op_cells_compare(stack, memory)); NEXT;
+do_cells_search:    COLD(op_cells_search(stack, memory)); NEXT;
+
+/* STACK */
+do_dup:             sp[-1] = tos; sp++; NEXT;
+do_drop:            POP(); NEXT;
+do_swap:            a = sp[-2]; sp[-2] = tos; tos = a; NEXT;
+do_over:            sp[-1] = tos; tos = sp[-2]; sp++; NEXT;
+do_rot:             a = sp[-3]; sp[-3] = sp[-2]; sp[-2] = tos; tos = a; NEXT;
+do_pick:            COLD(op_pick(stack)); NEXT;
+do_roll:            COLD(op_roll(stack)); NEXT;
+do_depth:           a = sp - base; PUSH(a); NEXT;
+do_to_r:            COLD(op_to_r(stack, return_stack)); NEXT;
+do_r_from:          COLD(op_r_from(stack, return_stack)); NEXT;
+do_r_fetch:         COLD(op_r_fetch(stack, return_stack)); NEXT;
+
+/* IO-NUMBERS */
+do_print:           COLD(op_print(stack, memory)); NEXT;
+do_d_print:         COLD(op_d_print(stack, memory)); NEXT;
+do_base:            PUSH(BASE_CELL); NEXT;
+do_decimal:         op_decimal(stack, memory); NEXT;
+do_hex:             op_hex(stack, memory); NEXT;
+do_binary:          op_binary(stack, memory); NEXT;
+
+/* DEFINING */
+do_colon:           op_colon(); NEXT;
+do_semicolon:       op_semicolon(); NEXT;
+do_tick:            COLD(op_tick()); NEXT;
+
+/* EXECUTION */
+do_execute:         COLD(op_execute(stack, return_stack)); NEXT;
+do_catch:           COLD(op_catch(stack, return_stack)); NEXT;
+do_throw:           COLD(op_throw(stack)); NEXT;
+do_par_map:         COLD(op_par_map(stack)); NEXT;
+do_par_reduce:      COLD(op_par_reduce(stack, return_stack)); NEXT;
+
+/* TASKS: see Task.c */
+do_spawn:           COLD(op_spawn(stack)); NEXT;
+do_stop:            COLD(op_stop()); NEXT;
+do_tasks:           COLD(op_tasks(stack)); NEXT;
+do_user_area:       COLD(op_user_area(stack)); NEXT;
+do_pause:
+    if (resume) {
+        SPILL();
+        resume->ip = ip;
+        resume->rp = rp;
+        resume->lp = lp;
+        resume->index = index;
+        resume->limit = limit;
+        return;
+    }
+    COLD(op_pause());
+    NEXT;
+
+/* TOOLS */
+do_fusions:         op_fusions(); NEXT;
+do_flush:           op_flush(); NEXT;
+do_profile_on:      op_profile_on(); NEXT;
+do_profile_off:     op_profile_off(); NEXT;
+do_profile_dump:    op_profile_dump(); NEXT;
+do_save_image:      COLD(op_save_image()); NEXT;
+do_load_image:      COLD(execute_primitive(instr->entry, stack, return_stack, memory)); NEXT;
+do_native:          COLD(execute_primitive(instr->entry, stack, return_stack, memory)); NEXT;
+
+/* PSEUDO */
+do_exit:            SPILL(); op_exit(); NEXT;
+
+/*
+ *  CONTROL: ip is already past the branch, which is what offsets count from.
+ *  The innermost loop's index and limit stay in locals; DO saves the
+ *  enclosing ones to loops[], where J finds its index.
+ */
+do_control:         COLD(execute_primitive(instr->entry, stack, return_stack, memory)); NEXT;
+do_branch:          ip += instr->value; NEXT;
+do_zero_branch:
+    a = tos;
+    POP();
+    if (a == 0)
+        ip += instr->value;
+    NEXT;
+do_true_branch:
+    a = tos;
+    POP();
+    if (a != 0)
+        ip += instr->value;
+    NEXT;
+do_do:
+    if (lp == LOOP_DEPTH) {
+        vm_throw(THROW_RSTACK_OVERFLOW, "DO loops nested too deep\n");
+    }
+    loops[lp].index = index;
+    loops[lp].limit = limit;
+    lp++;
+    index = tos;
+    limit = sp[-2];
+    sp -= 2;
+    tos = UNDER;
+    NEXT;
+do_loop:
+    if (++index < limit) {
+        ip += instr->value;
+        NEXT;
+    }
+    UNLOOP(1);
+    NEXT;
+do_plus_loop:
+    a = tos;
+    POP();
+    index += a;
+    if ((a < 0) ? (index >= limit) : (index < limit)) {
+        ip += instr->value;
+        NEXT;
+    }
+    UNLOOP(1);
+    NEXT;
+do_i:               PUSH(index); NEXT;
+do_j:               PUSH(loops[lp - 1].index); NEXT;
+do_leave:           limit = index; NEXT;
+do_unloop:          UNLOOP(instr->value); NEXT;
+
+/* SUPERINSTRUCTIONS: literal addresses were range-checked by the peephole pass */
+do_dup_add:         tos += tos; NEXT;
+do_nip:             sp--; NEXT;
+do_two_dup:         sp[-1] = tos; sp[0] = sp[-2]; sp += 2; NEXT;
+do_lit_add:         tos += instr->value; NEXT;
+do_lit_fetch:       PUSH(memory[instr->value]); NEXT;
+do_lit_store:       memory[instr->value] = tos; POP(); NEXT;
+
+#undef NEXT
+#undef UNLOOP
+#undef COLD
+#undef BINARY
+#undef POP
+#undef PUSH
+#undef RELOAD
+#undef SPILL
+#undef UNDER
+}
+
+void execute(const DictEntry *entry, Stack *stack, Stack *return_stack, Cell *memory) {
+    const Instr program[2] = {
+        { .op = entry->opcode, .in = entry->in, .out = entry->out, .entry = entry },
+        { .op = OPC_RET, .entry = &word_ret }
+    };
+    run(program, stack, return_stack, memory, NULL);
+}
+
+bool resume_task(Resume *resume, Stack *stack, Stack *return_stack, Cell *memory) {
+    run(resume->ip, stack, return_stack, memory, resume);
+    return resume->ip != NULL;
+}
+
+#else
+
+/*
+ *  Portable dispatch (make DISPATCH=switch): switch on the OpType and call
+ *  through the func union, as the outer interpreter always did. A task
+ *  keeps its calls and loops in its Resume, as in the direct engine.
+ */
+static void run(const Instr *ip, Stack *stack, Stack *return_stack, Cell *memory, Resume *resume) {
+    const Instr *own_calls[CALL_DEPTH];
+    Loop own_loops[LOOP_DEPTH];
+    const Instr **calls = resume ? resume->calls : own_calls;
+    Loop *loops = resume ? resume->loops : own_loops;
+    int rp = resume ? resume->rp : 0;
+    int lp = resume ? resume->lp : 0;
+    Cell n;
+
+    while (true) {
+        const Instr *instr = ip++;
+        const DictEntry *word = instr->entry;
+        PROFILE_STEP(instr);
+        switch (word->type) {
+            case OP_LIT:
+                push(stack, instr->value);
+                break;
+            case OP_RET:
+                PROFILE_RETURN();
+                if (rp == 0) {
+                    if (resume)
+                        resume->ip = NULL;
+                    return;
+                }
+                ip = calls[--rp];
+                break;
+            case OP_COLON:
+                if (rp == CALL_DEPTH) {
+                    vm_throw(THROW_RSTACK_OVERFLOW, "Call stack overflow in %s\n", word->word);
+                }
+                calls[rp++] = ip;
+                ip = word->func.colon->body;
+                break;
+            case OP_CONTROL:
+                switch (instr->op) {
+                    case OPC_BRANCH:
+                        ip += instr->value;
+                        break;
+                    case OPC_ZERO_BRANCH:
+                        if (pop(stack) == 0)
+                            ip += instr->value;
+                        break;
+                    case OPC_TRUE_BRANCH:
+                        if (pop(stack) != 0)
+                            ip += instr->value;
+                        break;
+                    case OPC_DO:
+                        if (lp == LOOP_DEPTH) {
+                            vm_throw(THROW_RSTACK_OVERFLOW, "DO loops nested too deep\n");
+                        }
+                        loops[lp].index = pop(stack);
+                        loops[lp].limit = pop(stack);
+                        lp++;
+                        break;
+                    case OPC_LOOP:
+                        if (++loops[lp - 1].index < loops[lp - 1].limit)
+                            ip += instr->value;
+                        else
+                            lp--;
+                        break;
+                    case OPC_PLUS_LOOP:
+                        n = pop(stack);
+                        loops[lp - 1].index += n;
+                        if ((n < 0) ? (loops[lp - 1].index >= loops[lp - 1].limit)
+                                    : (loops[lp - 1].index < loops[lp - 1].limit))
+                            ip += instr->value;
+                        else
+                            lp--;
+                        break;
+                    case OPC_I:     push(stack, loops[lp - 1].index); break;
+                    case OPC_J:     push(stack, loops[lp - 2].index); break;
+                    case OPC_LEAVE: loops[lp - 1].limit = loops[lp - 1].index; break;
+                    case OPC_UNLOOP: lp -= instr->value; break;
+                    default:        break;
+                }
+                break;
+            case OP:
+                if (instr->op == OPC_PAUSE && resume) {
+                    resume->ip = ip;
+                    resume->rp = rp;
+                    resume->lp = lp;
+                    return;
+                }
+                execute_primitive(word, stack, return_stack, memory);
+                break;
+            default:
+                execute_primitive(word, stack, return_stack, memory);
+                break;
+        }
+    }
+}
+
+void execute(const DictEntry *entry, Stack *stack, Stack *return_stack, Cell *memory) {
+#ifdef YAFI_PROFILE
+    const Instr call = { .op = entry->opcode, .entry = entry };
+    const Instr ret = { .op = OPC_RET, .entry = &word_ret };
+    PROFILE_STEP(&call);
+#endif
+    if (entry->type != OP_COLON) {
+        execute_primitive(entry, stack, return_stack, memory);
+        PROFILE_STEP(&ret);
+        return;
+    }
+    run(entry->func.colon->body, stack, return_stack, memory, NULL);
+}
+
+bool resume_task(Resume *resume, Stack *stack, Stack *return_stack, Cell *memory) {
+    run(resume->ip, stack, return_stack, memory, resume);
+    return resume->ip != NULL;
+}
+
+#endif
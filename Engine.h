@@ -0,0 +1,53 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Inner interpreter for threaded code
+ * License:         MIT
+ */
+
+#include "forth.h"
+
+#define CALL_DEPTH 256
+#define LOOP_DEPTH 64
+
+/* a DO loop outside the innermost one */
+typedef struct {
+    Cell index;
+    Cell limit;
+} Loop;
+
+/* where a task stopped at PAUSE: the inner interpreter's registers, so switching is a few stores */
+typedef struct {
+    const Instr *ip;            /* NULL once the task has returned */
+    const Instr *calls[CALL_DEPTH];
+    int rp;
+    Loop loops[LOOP_DEPTH];
+    int lp;
+    Cell index;                 /* the innermost loop, which the direct engine keeps out of loops[] */
+    Cell limit;
+} Resume;
+
+/* internal words that only appear inside threaded code */
+extern const DictEntry word_lit;
+extern const DictEntry word_ret;
+
+/* compiled by the control-flow words; a branch's value is its offset from the instruction after it */
+extern const DictEntry word_branch;
+extern const DictEntry word_zero_branch;
+extern const DictEntry word_true_branch;
+extern const DictEntry word_do;
+extern const DictEntry word_loop;
+extern const DictEntry word_plus_loop;
+extern const DictEntry word_i;
+extern const DictEntry word_j;
+extern const DictEntry word_leave;
+extern const DictEntry word_unloop;
+
+void execute(const DictEntry *entry, Stack *stack, Stack *return_stack, Cell *memory);
+
+/* runs a task from where it was until its next PAUSE (true) or its return (false) */
+bool resume_task(Resume *resume, Stack *stack, Stack *return_stack, Cell *memory);
+
+#endif
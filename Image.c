@@ -0,0 +1,579 @@
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     VM images
+ * License:         MIT
+ *
+ * An image is written in the byte order and cell size of the build that
+ * saved it:
+ *
+ *   ImageHeader
+ *   data stack, then return stack       Cell[depth], Cell[return_depth]
+ *   words, oldest first                 ImageWord, name, ImageInstr[length]
+ *   execution tokens                    ImageRef[xts]
+ *   memory, system cells included       Cell[cells] at memory_at, padded to IMAGE_ALIGN
+ *
+ * Threaded code points at dictionary entries; the image stores those as
+ * references instead: a built-in by its row in dictionary[], an internal
+ * word (literal, branch, superinstruction) by its row in internal_words[],
+ * a defined word by the order it was defined in. Loading allocates fresh
+ * entries and resolves the references against them, so nothing depends on
+ * where the saving process had them. Those rows, like the opcodes, are
+ * numbers of the build that saved the image; the header carries a hash of
+ * the built-in set, and an image from a build with another one is refused.
+ *
+ * Nothing read from the file is trusted: an instruction takes its opcode
+ * and stack effect from the entry it resolves to, branches and loops must
+ * land inside their own body, loop words must sit inside a loop, a call
+ * must reach a colon definition and a literal address must be in memory.
+ *
+ * Memory is the bulk of a large image and is never read at load time: its
+ * section is mapped MAP_PRIVATE over the VM's memory, so pages come in from
+ * the page cache as they are touched and stay shared between every process
+ * running the same image until one writes to them. Pages of zeros are left
+ * as holes when saving.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Image.h"
+#include "Engine.h"
+#include "Peephole.h"
+
+#define IMAGE_MAGIC     "YAFI-IMG"
+#define IMAGE_VERSION   2
+
+/* superinstructions only exist with direct dispatch, so code from one build does not run on the other */
+#ifdef YAFI_SWITCH_DISPATCH
+#define IMAGE_BUILD     1u
+#else
+#define IMAGE_BUILD     0u
+#endif
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t cell_size;
+    uint32_t build;
+    uint32_t words;
+    uint32_t xts;
+    uint32_t depth;
+    uint32_t return_depth;
+    uint32_t builtins;          /* builtin_hash() of the saving build */
+    uint64_t cells;
+    uint64_t memory_at;
+} ImageHeader;
+
+typedef enum {
+    REF_BUILTIN,
+    REF_INTERNAL,
+    REF_WORD
+} RefKind;
+
+typedef struct {
+    uint32_t kind;
+    uint32_t index;
+} ImageRef;
+
+typedef struct {
+    uint32_t name_length;
+    uint32_t length;
+} ImageWord;
+
+typedef struct {
+    Cell value;
+    ImageRef entry;
+    uint16_t op;
+    int8_t in;
+    int8_t out;
+} ImageInstr;
+
+/* every entry threaded code can point at that is neither a built-in nor defined */
+static const DictEntry *const internal_words[] = {
+    &word_lit, &word_ret,
+    &word_branch, &word_zero_branch, &word_true_branch,
+    &word_do, &word_loop, &word_plus_loop, &word_i, &word_j, &word_leave, &word_unloop,
+    &word_dup_add, &word_nip, &word_two_dup, &word_lit_add, &word_lit_fetch, &word_lit_store,
+};
+
+#define INTERNAL_COUNT  (sizeof(internal_words) / sizeof(internal_words[0]))
+
+static uint32_t builtin_count(void) {
+    uint32_t n = 0;
+    while (dictionary[n].word)
+        n++;
+    return n;
+}
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+static uint32_t hash_entry(uint32_t hash, const DictEntry *entry) {
+    const int32_t fields[] = { entry->type, entry->opcode, entry->in, entry->out };
+    hash = fnv1a(hash, entry->word, strlen(entry->word) + 1);
+    return fnv1a(hash, fields, sizeof(fields));
+}
+
+/* every row and opcode number an image can hold */
+static uint32_t builtin_hash(void) {
+    const int32_t opcodes = OPCODE_COUNT;
+    uint32_t hash = fnv1a(2166136261u, &opcodes, sizeof(opcodes));
+    for (const DictEntry *entry = dictionary; entry->word; entry++)
+        hash = hash_entry(hash, entry);
+    for (uint32_t i = 0; i < INTERNAL_COUNT; i++)
+        hash = hash_entry(hash, internal_words[i]);
+    return hash;
+}
+
+static size_t round_up(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+/*
+ *  SAVE
+ */
+
+/* defined words sorted by address, so a reference is found in log time */
+typedef struct {
+    const DictEntry *entry;
+    uint32_t index;
+} Indexed;
+
+typedef struct {
+    FILE *file;
+    Indexed *words;
+    uint32_t word_count;
+    uint32_t builtins;
+    const DictEntry *unsaved;   /* referred to, but neither built in, internal nor defined */
+    bool ok;
+} Writer;
+
+static int by_entry(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)((const Indexed *)a)->entry;
+    uintptr_t y = (uintptr_t)((const Indexed *)b)->entry;
+    return (x > y) - (x < y);
+}
+
+static void put(Writer *w, const void *data, size_t size) {
+    if (w->ok && size > 0 && fwrite(data, size, 1, w->file) != 1)
+        w->ok = false;
+}
+
+/* false, with the entry kept for the error, when nothing in an image can stand for it */
+static bool reference(Writer *w, const DictEntry *entry, ImageRef *ref) {
+    uintptr_t at = (uintptr_t)entry;
+    if (at >= (uintptr_t)dictionary && at < (uintptr_t)(dictionary + w->builtins)) {
+        *ref = (ImageRef){ REF_BUILTIN, (uint32_t)(entry - dictionary) };
+        return true;
+    }
+    for (uint32_t i = 0; i < INTERNAL_COUNT; i++) {
+        if (internal_words[i] == entry) {
+            *ref = (ImageRef){ REF_INTERNAL, i };
+            return true;
+        }
+    }
+    Indexed key = { entry, 0 };
+    const Indexed *found = bsearch(&key, w->words, w->word_count, sizeof(Indexed), by_entry);
+    if (found) {
+        *ref = (ImageRef){ REF_WORD, found->index };
+        return true;
+    }
+    w->unsaved = entry;
+    w->ok = false;
+    return false;
+}
+
+static bool all_zero(const uint8_t *bytes, size_t length) {
+    return length == 0 || (bytes[0] == 0 && memcmp(bytes, bytes + 1, length - 1) == 0);
+}
+
+static void put_memory(Writer *w, const Memory *memory) {
+    const uint8_t *bytes = (const uint8_t *)memory->data;
+    size_t total = (size_t)memory->cells * sizeof(Cell);
+    for (size_t at = 0; at < total && w->ok; at += IMAGE_ALIGN) {
+        size_t n = (total - at < IMAGE_ALIGN) ? total - at : IMAGE_ALIGN;
+        if (all_zero(bytes + at, n)) {
+            if (fseeko(w->file, (off_t)n, SEEK_CUR) != 0)
+                w->ok = false;
+        } else {
+            put(w, bytes + at, n);
+        }
+    }
+}
+
+static void save_to(Vm *vm, Writer *w) {
+    const WordTable *words = &vm->words;
+    ImageHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.cell_size = sizeof(Cell);
+    header.build = IMAGE_BUILD;
+    header.words = words->added_count;
+    header.xts = (uint32_t)vm->xt_count;
+    header.depth = (uint32_t)vm->stack.top;
+    header.return_depth = (uint32_t)vm->return_stack.top;
+    header.builtins = builtin_hash();
+    header.cells = (uint64_t)vm->memory.cells;
+    put(w, &header, sizeof(header));
+    put(w, vm->stack.data, vm->stack.top * sizeof(Cell));
+    put(w, vm->return_stack.data, vm->return_stack.top * sizeof(Cell));
+
+    for (uint32_t i = 0; i < words->added_count; i++) {
+        const DictEntry *entry = words->added[i];
+        const Definition *colon = entry->func.colon;
+        ImageWord word = { (uint32_t)strlen(entry->word), (uint32_t)colon->length };
+        put(w, &word, sizeof(word));
+        put(w, entry->word, word.name_length);
+        for (int j = 0; j < colon->length; j++) {
+            const Instr *instr = &colon->body[j];
+            ImageInstr out;
+            memset(&out, 0, sizeof(out));   /* the padding goes to the file too */
+            out.value = instr->value;
+            reference(w, instr->entry, &out.entry);
+            out.op = instr->op;
+            out.in = instr->in;
+            out.out = instr->out;
+            put(w, &out, sizeof(out));
+        }
+    }
+    for (int i = 0; i < vm->xt_count; i++) {
+        ImageRef ref;
+        if (reference(w, vm->xts[i], &ref))
+            put(w, &ref, sizeof(ref));
+    }
+
+    off_t end = w->ok ? ftello(w->file) : -1;
+    if (end < 0) {
+        w->ok = false;
+        return;
+    }
+    header.memory_at = round_up((size_t)end, IMAGE_ALIGN);
+    if (fseeko(w->file, (off_t)header.memory_at, SEEK_SET) != 0)
+        w->ok = false;
+    put_memory(w, &vm->memory);
+
+    /* trailing holes only exist once the file is that long */
+    off_t size = (off_t)(header.memory_at + round_up((size_t)header.cells * sizeof(Cell), IMAGE_ALIGN));
+    if (w->ok && (fflush(w->file) != 0 || ftruncate(fileno(w->file), size) != 0))
+        w->ok = false;
+    if (w->ok && fseeko(w->file, 0, SEEK_SET) != 0)
+        w->ok = false;
+    put(w, &header, sizeof(header));
+}
+
+/*
+ *  Written beside the target and renamed over it: a process that has the
+ *  old image mapped keeps its pages instead of seeing them change.
+ */
+void image_save(Vm *vm, const char *path) {
+    const WordTable *words = &vm->words;
+    Writer w = { .builtins = builtin_count(), .ok = true };
+
+    for (uint32_t i = 0; i < words->added_count; i++) {
+        if (words->added[i]->type != OP_COLON)
+            vm_throw(THROW_UNSUPPORTED, "SAVE-IMAGE: %s is native code and cannot be saved\n", words->added[i]->word);
+    }
+
+    size_t length = strlen(path) + sizeof(".tmp");
+    char *temporary = malloc(length);
+    w.words = malloc((words->added_count + 1) * sizeof(Indexed));
+    if (!temporary || !w.words) {
+        fprintf(stderr, "Out of memory in SAVE-IMAGE\n");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(temporary, length, "%s.tmp", path);
+    for (uint32_t i = 0; i < words->added_count; i++)
+        w.words[i] = (Indexed){ words->added[i], i };
+    w.word_count = words->added_count;
+    qsort(w.words, w.word_count, sizeof(Indexed), by_entry);
+
+    w.file = fopen(temporary, "wb");
+    if (!w.file) {
+        free(w.words);
+        free(temporary);
+        vm_throw(THROW_FILE_IO, "SAVE-IMAGE: cannot create %s\n", path);
+    }
+    save_to(vm, &w);
+
+    bool closed = (fclose(w.file) == 0);
+    bool ok = w.ok && closed && rename(temporary, path) == 0;
+    if (!ok)
+        remove(temporary);
+    free(w.words);
+    free(temporary);
+    if (w.unsaved)
+        vm_throw(THROW_UNSUPPORTED, "SAVE-IMAGE: no way to save a reference to %s\n", w.unsaved->word);
+    if (!ok)
+        vm_throw(THROW_FILE_IO, "SAVE-IMAGE: cannot write %s\n", path);
+}
+
+/*
+ *  LOAD
+ */
+
+/* the mapped file, consumed front to back; every take is bounds-checked */
+typedef struct {
+    const uint8_t *at;
+    const uint8_t *end;
+} Reader;
+
+static const void *take(Reader *r, size_t size) {
+    if ((size_t)(r->end - r->at) < size)
+        return NULL;
+    const void *data = r->at;
+    r->at += size;
+    return data;
+}
+
+/* everything a load allocates, held aside until the whole image has checked out */
+typedef struct {
+    DictEntry **entries;
+    uint32_t count;
+    const DictEntry **xts;
+} Loaded;
+
+static void discard(Loaded *l) {
+    for (uint32_t i = 0; i < l->count; i++) {
+        if (l->entries[i]->func.colon)
+            free(l->entries[i]->func.colon->body);
+        free(l->entries[i]->func.colon);
+        free((char *)l->entries[i]->word);
+        free(l->entries[i]);
+    }
+    free(l->entries);
+    free(l->xts);
+}
+
+static const DictEntry *resolve(const Loaded *l, ImageRef ref, uint32_t builtins) {
+    switch (ref.kind) {
+        case REF_BUILTIN:   return (ref.index < builtins) ? &dictionary[ref.index] : NULL;
+        case REF_INTERNAL:  return (ref.index < INTERNAL_COUNT) ? internal_words[ref.index] : NULL;
+        case REF_WORD:      return (ref.index < l->count) ? l->entries[ref.index] : NULL;
+        default:            return NULL;
+    }
+}
+
+/* DO .. LOOP pairs around each instruction; false if a branch or loop leaves the body */
+static bool loop_depths(const Instr *body, int length, int *depth) {
+    for (int j = 0; j < length; j++) {
+        int64_t target = (int64_t)j + 1 + body[j].value;
+        switch (body[j].op) {
+            case OPC_BRANCH: case OPC_ZERO_BRANCH: case OPC_TRUE_BRANCH:
+                if (target < 0 || target >= length)
+                    return false;
+                break;
+            case OPC_LOOP: case OPC_PLUS_LOOP:
+                if (target < 1 || target > j || body[target - 1].op != OPC_DO)
+                    return false;
+                for (int k = (int)target; k <= j; k++)
+                    depth[k]++;
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+static bool valid_body(const Instr *body, int length, uint64_t cells, int *depth) {
+    if (body[length - 1].op != OPC_RET || !loop_depths(body, length, depth))
+        return false;
+    for (int j = 0; j < length; j++) {
+        const Instr *instr = &body[j];
+        switch (instr->op) {
+            case OPC_CALL:
+                if (instr->entry->type != OP_COLON)
+                    return false;
+                break;
+            case OPC_LIT_FETCH: case OPC_LIT_STORE:
+                if (instr->value < 0 || (uint64_t)instr->value >= cells)
+                    return false;
+                break;
+            case OPC_I: case OPC_LEAVE:
+                if (depth[j] < 1)
+                    return false;
+                break;
+            case OPC_J:
+                if (depth[j] < 2)
+                    return false;
+                break;
+            case OPC_UNLOOP:
+                if (instr->value < 1 || instr->value > depth[j])
+                    return false;
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+static bool load_words(Reader *r, Loaded *l, uint32_t builtins, uint64_t cells) {
+    for (uint32_t i = 0; i < l->count; i++) {
+        DictEntry *entry = l->entries[i];
+        const ImageWord *word = take(r, sizeof(ImageWord));
+        const char *name = word ? take(r, word->name_length) : NULL;
+        if (!name || word->length == 0 || word->length > INT32_MAX / sizeof(Instr))
+            return false;
+
+        Definition *colon = malloc(sizeof(Definition));
+        char *copy = malloc(word->name_length + 1);
+        Instr *body = malloc(word->length * sizeof(Instr));
+        entry->word = copy;
+        entry->func.colon = colon;
+        if (!colon || !copy || !body) {
+            fprintf(stderr, "Out of memory in LOAD-IMAGE\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(copy, name, word->name_length);
+        copy[word->name_length] = '\0';
+        colon->body = body;
+        colon->length = (int)word->length;
+        colon->calls = 0;
+        colon->native = NULL;
+
+        /* the file's opcode and stack effect only have to agree with the entry's */
+        for (uint32_t j = 0; j < word->length; j++) {
+            const ImageInstr *in = take(r, sizeof(ImageInstr));
+            const DictEntry *entry = in ? resolve(l, in->entry, builtins) : NULL;
+            if (!entry || in->op != entry->opcode || in->in != entry->in || in->out != entry->out)
+                return false;
+            body[j].op = entry->opcode;
+            body[j].in = entry->in;
+            body[j].out = entry->out;
+            body[j].value = in->value;
+            body[j].entry = entry;
+        }
+        int *depth = calloc(word->length, sizeof(int));
+        if (!depth) {
+            fprintf(stderr, "Out of memory in LOAD-IMAGE\n");
+            exit(EXIT_FAILURE);
+        }
+        bool valid = valid_body(body, colon->length, cells, depth);
+        free(depth);
+        if (!valid)
+            return false;
+    }
+    return true;
+}
+
+/* words, tokens and stacks from the image; the memory section stays in the file */
+static bool load_from(Reader *r, const ImageHeader *header, Loaded *l, const Cell **stacks) {
+    uint32_t builtins = builtin_count();
+
+    *stacks = take(r, ((size_t)header->depth + header->return_depth) * sizeof(Cell));
+    if (!*stacks)
+        return false;
+
+    l->entries = calloc(header->words + 1, sizeof(DictEntry *));
+    l->xts = malloc((header->xts + 1) * sizeof(DictEntry *));
+    if (!l->entries || !l->xts) {
+        fprintf(stderr, "Out of memory in LOAD-IMAGE\n");
+        exit(EXIT_FAILURE);
+    }
+    for (; l->count < header->words; l->count++) {
+        DictEntry *entry = calloc(1, sizeof(DictEntry));
+        if (!entry) {
+            fprintf(stderr, "Out of memory in LOAD-IMAGE\n");
+            exit(EXIT_FAILURE);
+        }
+        entry->type = OP_COLON;
+        entry->opcode = OPC_CALL;
+        l->entries[l->count] = entry;
+    }
+    if (!load_words(r, l, builtins, header->cells))
+        return false;
+
+    for (uint32_t i = 0; i < header->xts; i++) {
+        const ImageRef *ref = take(r, sizeof(ImageRef));
+        l->xts[i] = ref ? resolve(l, *ref, builtins) : NULL;
+        if (!l->xts[i])
+            return false;
+    }
+    return true;
+}
+
+static bool valid_header(const ImageHeader *header, size_t size) {
+    return memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) == 0
+        && header->version == IMAGE_VERSION
+        && header->cell_size == sizeof(Cell)
+        && header->build == IMAGE_BUILD
+        && header->builtins == builtin_hash()
+        && header->depth <= STACK_SIZE
+        && header->return_depth <= STACK_SIZE
+        && header->cells > SYSTEM_CELLS
+        && header->cells <= MEMORY_MAX_CELLS
+        && header->memory_at % IMAGE_ALIGN == 0
+        && header->memory_at <= size
+        && header->cells * sizeof(Cell) <= size - header->memory_at;
+}
+
+/*
+ *  Everything is checked and allocated before the VM is touched. Then the
+ *  image's words replace the visible ones, and its tokens, stacks and memory
+ *  replace the VM's. Words defined before stay allocated, as after any
+ *  redefinition, since compiled code may still refer to them.
+ */
+void image_load(Vm *vm, const char *path) {
+    if (vm->tasks.live > 0)
+        vm_throw(THROW_UNSUPPORTED, "LOAD-IMAGE while tasks are running\n");
+
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ImageHeader)) {
+        if (fd >= 0)
+            close(fd);
+        vm_throw(THROW_FILE_IO, "LOAD-IMAGE: cannot read %s\n", path);
+    }
+    size_t size = (size_t)st.st_size;
+    const uint8_t *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (file == MAP_FAILED) {
+        close(fd);
+        vm_throw(THROW_FILE_IO, "LOAD-IMAGE: cannot map %s\n", path);
+    }
+
+    Reader r = { file, file + size };
+    const ImageHeader *header = take(&r, sizeof(ImageHeader));
+    Loaded l = { NULL, 0, NULL };
+    const Cell *stacks = NULL;
+    Memory memory = { NULL, 0, 0 };
+    bool ok = valid_header(header, size)
+           && load_from(&r, header, &l, &stacks)
+           && memory_load(&memory, (size_t)header->cells, fd, (size_t)header->memory_at);
+    if (!ok) {
+        discard(&l);
+        munmap((void *)file, size);
+        close(fd);
+        vm_throw(THROW_INVALID_ARGUMENT, "LOAD-IMAGE: %s is not an image for this build\n", path);
+    }
+
+    hide_words(&vm->words);
+    for (uint32_t i = 0; i < l.count; i++)
+        add_entry(l.entries[i]);
+    free(l.entries);
+
+    free(vm->xts);
+    vm->xts = l.xts;
+    vm->xt_count = (int)header->xts;
+    vm->xt_capacity = (int)header->xts + 1;
+
+    memcpy(vm->stack.data, stacks, header->depth * sizeof(Cell));
+    vm->stack.top = (int)header->depth;
+    memcpy(vm->return_stack.data, stacks + header->depth, header->return_depth * sizeof(Cell));
+    vm->return_stack.top = (int)header->return_depth;
+
+    memory_destroy(&vm->memory);
+    vm->memory = memory;
+    task_release(vm);
+    vm_enter(vm);
+
+    munmap((void *)file, size);
+    close(fd);
+}
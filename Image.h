@@ -0,0 +1,21 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     VM images: the words, execution tokens, stacks and memory
+ *                  of a VM in one file, loaded with the memory mapped
+ *                  copy-on-write so startup does not depend on its size
+ * License:         MIT
+ */
+
+#include "Vm.h"
+
+/* the memory section starts on a multiple of this, so any page size can map it */
+#define IMAGE_ALIGN     65536
+
+/* both THROW on failure; a failed load leaves the VM as it was */
+void image_save(Vm *vm, const char *path);
+void image_load(Vm *vm, const char *path);
+
+#endif
@@ -0,0 +1,452 @@
+#include "Jit.h"
+#include "Vm.h"
+
+bool jit_enabled = true;
+
+/* set while this thread runs a PAR-MAP or PAR-REDUCE job, whose threads share the code */
+_Thread_local bool jit_held = false;
+
+#ifdef YAFI_JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define ARENA_SIZE  (256 * 1024)
+
+typedef struct {
+    uint8_t *bytes;
+    size_t length;
+    size_t capacity;
+} Code;
+
+/* one arena for every VM; code is never freed, so only installing needs the lock */
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *arena = NULL;
+static size_t arena_used = 0;
+static size_t page_size = 0;
+
+static void emit_bytes(Code *c, const uint8_t *bytes, size_t n) {
+    if (c->length + n > c->capacity) {
+        c->capacity = c->capacity ? c->capacity * 2 : 256;
+        while (c->length + n > c->capacity)
+            c->capacity *= 2;
+        c->bytes = realloc(c->bytes, c->capacity);
+        if (!c->bytes) {
+            fprintf(stderr, "Out of memory in JIT\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(c->bytes + c->length, bytes, n);
+    c->length += n;
+}
+
+#define ASM(...)   do { const uint8_t b_[] = { __VA_ARGS__ }; emit_bytes(c, b_, sizeof(b_)); } while (0)
+
+static void emit_imm32(Code *c, int value) {
+    uint32_t v = (uint32_t)value;
+    ASM(v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, (v >> 24) & 0xFF);
+}
+
+/* mov edx, code; xor eax, eax; ret -- 8 bytes, skipped by a jcc rel8 of 8 */
+static void emit_fault(Code *c, JitFault fault) {
+    ASM(0xBA);
+    emit_imm32(c, fault);
+    ASM(0x31, 0xC0, 0xC3);
+}
+
+static void emit_push_tos(Code *c) {
+    ASM(0x89, 0x47, 0xFC);                 // mov [rdi-4], eax
+    ASM(0x48, 0x83, 0xC7, 0x04);           // add rdi, 4
+}
+
+static void emit_pop_tos(Code *c) {
+    ASM(0x48, 0x83, 0xEF, 0x04);           // sub rdi, 4
+    ASM(0x8B, 0x47, 0xFC);                 // mov eax, [rdi-4]
+}
+
+/* ecx = nos, drop it from memory; the result goes to eax */
+static void emit_binary(Code *c) {
+    ASM(0x8B, 0x4F, 0xF8);                 // mov ecx, [rdi-8]
+    ASM(0x48, 0x83, 0xEF, 0x04);           // sub rdi, 4
+}
+
+/* eax = flag from the setcc opcode byte, as -1/0 */
+static void emit_flag(Code *c, uint8_t setcc) {
+    ASM(0x0F, setcc, 0xC0);                // setcc al
+    ASM(0x0F, 0xB6, 0xC0);                 // movzx eax, al
+    ASM(0xF7, 0xD8);                       // neg eax
+}
+
+/* addresses index as unsigned 32-bit, which the guarded memory layout also covers */
+/* 'limit' is memory_cells for @ and !, the size in bytes for C@ and C! */
+static void emit_bounds(Code *c, JitFault fault, uint32_t limit) {
+#ifdef YAFI_GUARDED_MEMORY
+    (void)c;
+    (void)fault;
+    (void)limit;
+#else
+    ASM(0x3D);                             // cmp eax, limit
+    emit_imm32(c, (int)limit);
+    ASM(0x72, 0x08);                       // jb ok
+    emit_fault(c, fault);
+#endif
+}
+
+/* byte addresses run to four times memory_cells, which need not fit 32 bits */
+static uint32_t memory_bytes(void) {
+    uint64_t bytes = (uint64_t)memory_cells * sizeof(Cell);
+    return (bytes > UINT32_MAX) ? UINT32_MAX : (uint32_t)bytes;
+}
+
+static void emit_nonzero(Code *c, JitFault fault) {
+    ASM(0x85, 0xC0);                       // test eax, eax
+    ASM(0x75, 0x08);                       // jnz ok
+    emit_fault(c, fault);
+}
+
+/* CELL_MIN / -1 does not fit a cell and idiv traps on it; tos is the divisor, [rdi-8] the dividend */
+static void emit_no_overflow(Code *c, JitFault fault) {
+    ASM(0x83, 0xF8, 0xFF);                 // cmp eax, -1
+    ASM(0x75, 0x11);                       // jne ok
+    ASM(0x81, 0x7F, 0xF8);                 // cmp dword [rdi-8], INT32_MIN
+    emit_imm32(c, INT32_MIN);
+    ASM(0x75, 0x08);                       // jne ok
+    emit_fault(c, fault);
+}
+
+/*
+ *  Walks a body up to its first return, tracking the depth relative to the
+ *  entry depth. Branches and loops are unsupported, so everything after the
+ *  first (RET) is dead. Callees are inlined; anything unsupported rejects
+ *  the whole definition.
+ */
+static bool analyze(const Instr *ip, int level, int *depth, int *in, int *growth) {
+    if (level > JIT_INLINE_DEPTH)
+        return false;
+    for (;; ip++) {
+        switch (ip->op) {
+            case OPC_RET:
+                return true;
+            case OPC_CALL:
+                if (!analyze(ip->entry->func.colon->body, level + 1, depth, in, growth))
+                    return false;
+                continue;
+            case OPC_LIT:
+            case OPC_LESS_THAN: case OPC_EQUAL: case OPC_GREATER_THAN:
+            case OPC_ZERO_LESS: case OPC_ZERO_EQUAL: case OPC_ZERO_GREATER: case OPC_NOT:
+            case OPC_ADD: case OPC_SUB: case OPC_MUL: case OPC_DIV: case OPC_MOD: case OPC_DIVMOD:
+            case OPC_ONE_PLUS: case OPC_ONE_MINUS: case OPC_TWO_PLUS: case OPC_TWO_MINUS:
+            case OPC_MAX: case OPC_MIN: case OPC_ABS: case OPC_NEGATE:
+            case OPC_AND: case OPC_OR: case OPC_XOR:
+            case OPC_FETCH: case OPC_STORE: case OPC_CFETCH: case OPC_CSTORE:
+            case OPC_DUP: case OPC_DROP: case OPC_SWAP: case OPC_OVER: case OPC_ROT:
+            case OPC_DUP_ADD: case OPC_NIP: case OPC_TWO_DUP:
+            case OPC_LIT_ADD: case OPC_LIT_FETCH: case OPC_LIT_STORE:
+                break;
+            default:
+                return false;
+        }
+        if (ip->in - *depth > *in)
+            *in = ip->in - *depth;
+        *depth += ip->out - ip->in;
+        if (*depth > *growth)
+            *growth = *depth;
+    }
+}
+
+static void translate(Code *c, const Instr *ip) {
+    for (;; ip++) {
+        switch (ip->op) {
+            case OPC_RET:
+                return;
+            case OPC_CALL:
+                translate(c, ip->entry->func.colon->body);
+                break;
+            case OPC_LIT:
+                emit_push_tos(c);
+                ASM(0xB8);                         // mov eax, imm32
+                emit_imm32(c, ip->value);
+                break;
+
+            /* COMPUTATION */
+            case OPC_LESS_THAN:
+                emit_binary(c);
+                ASM(0x39, 0xC1);                   // cmp ecx, eax
+                emit_flag(c, 0x9C);                 // setl
+                break;
+            case OPC_EQUAL:
+                emit_binary(c);
+                ASM(0x39, 0xC1);
+                emit_flag(c, 0x94);                 // sete
+                break;
+            case OPC_GREATER_THAN:
+                emit_binary(c);
+                ASM(0x39, 0xC1);
+                emit_flag(c, 0x9F);                 // setg
+                break;
+            case OPC_ZERO_LESS:
+                ASM(0xC1, 0xF8, 0x1F);             // sar eax, 31
+                break;
+            case OPC_ZERO_EQUAL:
+                ASM(0x85, 0xC0);                   // test eax, eax
+                emit_flag(c, 0x94);
+                break;
+            case OPC_ZERO_GREATER:
+                ASM(0x85, 0xC0);
+                emit_flag(c, 0x9F);
+                break;
+            case OPC_NOT:
+                ASM(0xF7, 0xD0);                   // not eax
+                break;
+
+            /* LOGICAL */
+            case OPC_ADD:
+                emit_binary(c);
+                ASM(0x01, 0xC8);                   // add eax, ecx
+                break;
+            case OPC_SUB:
+                emit_binary(c);
+                ASM(0x29, 0xC1);                   // sub ecx, eax
+                ASM(0x89, 0xC8);                   // mov eax, ecx
+                break;
+            case OPC_MUL:
+                emit_binary(c);
+                ASM(0x0F, 0xAF, 0xC1);             // imul eax, ecx
+                break;
+            case OPC_DIV:
+            case OPC_MOD:
+                emit_nonzero(c, ip->op == OPC_DIV ? JIT_FAULT_DIV : JIT_FAULT_MOD);
+                emit_no_overflow(c, ip->op == OPC_DIV ? JIT_FAULT_DIV_RANGE : JIT_FAULT_MOD_RANGE);
+                emit_binary(c);
+                ASM(0x41, 0x89, 0xC1);             // mov r9d, eax
+                ASM(0x89, 0xC8);                   // mov eax, ecx
+                ASM(0x99);                         // cdq
+                ASM(0x41, 0xF7, 0xF9);             // idiv r9d
+                if (ip->op == OPC_MOD)
+                    ASM(0x89, 0xD0);               // mov eax, edx
+                break;
+            case OPC_DIVMOD:
+                emit_nonzero(c, JIT_FAULT_DIVMOD);
+                emit_no_overflow(c, JIT_FAULT_DIVMOD_RANGE);
+                ASM(0x41, 0x89, 0xC1);             // mov r9d, eax
+                ASM(0x8B, 0x47, 0xF8);             // mov eax, [rdi-8]
+                ASM(0x99);                         // cdq
+                ASM(0x41, 0xF7, 0xF9);             // idiv r9d
+                ASM(0x89, 0x57, 0xF8);             // mov [rdi-8], edx
+                break;
+            case OPC_ONE_PLUS:
+                ASM(0x83, 0xC0, 0x01);             // add eax, 1
+                break;
+            case OPC_ONE_MINUS:
+                ASM(0x83, 0xE8, 0x01);             // sub eax, 1
+                break;
+            case OPC_TWO_PLUS:
+                ASM(0x83, 0xC0, 0x02);
+                break;
+            case OPC_TWO_MINUS:
+                ASM(0x83, 0xE8, 0x02);
+                break;
+            case OPC_MAX:
+                emit_binary(c);
+                ASM(0x39, 0xC1);                   // cmp ecx, eax
+                ASM(0x0F, 0x4F, 0xC1);             // cmovg eax, ecx
+                break;
+            case OPC_MIN:
+                emit_binary(c);
+                ASM(0x39, 0xC1);
+                ASM(0x0F, 0x4C, 0xC1);             // cmovl eax, ecx
+                break;
+            case OPC_ABS:
+                ASM(0x89, 0xC1);                   // mov ecx, eax
+                ASM(0xF7, 0xD9);                   // neg ecx
+                ASM(0x0F, 0x49, 0xC1);             // cmovns eax, ecx
+                break;
+            case OPC_NEGATE:
+                ASM(0xF7, 0xD8);                   // neg eax
+                break;
+            case OPC_AND:
+                emit_binary(c);
+                ASM(0x21, 0xC8);                   // and eax, ecx
+                break;
+            case OPC_OR:
+                emit_binary(c);
+                ASM(0x09, 0xC8);                   // or eax, ecx
+                break;
+            case OPC_XOR:
+                emit_binary(c);
+                ASM(0x31, 0xC8);                   // xor eax, ecx
+                break;
+
+            /* MEMORY */
+            case OPC_FETCH:
+                emit_bounds(c, JIT_FAULT_FETCH, (uint32_t)memory_cells);
+                ASM(0x41, 0x8B, 0x04, 0x80);       // mov eax, [r8+rax*4]
+                break;
+            case OPC_STORE:
+                emit_bounds(c, JIT_FAULT_STORE, (uint32_t)memory_cells);
+                ASM(0x8B, 0x4F, 0xF8);             // mov ecx, [rdi-8]
+                ASM(0x41, 0x89, 0x0C, 0x80);       // mov [r8+rax*4], ecx
+                ASM(0x48, 0x83, 0xEF, 0x08);       // sub rdi, 8
+                ASM(0x8B, 0x47, 0xFC);             // mov eax, [rdi-4]
+                break;
+            case OPC_CFETCH:
+                emit_bounds(c, JIT_FAULT_CFETCH, memory_bytes());
+                ASM(0x41, 0x0F, 0xB6, 0x04, 0x00); // movzx eax, byte [r8+rax]
+                break;
+            case OPC_CSTORE:
+                emit_bounds(c, JIT_FAULT_CSTORE, memory_bytes());
+                ASM(0x8B, 0x4F, 0xF8);             // mov ecx, [rdi-8]
+                ASM(0x41, 0x88, 0x0C, 0x00);       // mov [r8+rax], cl
+                ASM(0x48, 0x83, 0xEF, 0x08);       // sub rdi, 8
+                ASM(0x8B, 0x47, 0xFC);             // mov eax, [rdi-4]
+                break;
+
+            /* STACK */
+            case OPC_DUP:
+                emit_push_tos(c);
+                break;
+            case OPC_DROP:
+                emit_pop_tos(c);
+                break;
+            case OPC_SWAP:
+                ASM(0x8B, 0x4F, 0xF8);             // mov ecx, [rdi-8]
+                ASM(0x89, 0x47, 0xF8);             // mov [rdi-8], eax
+                ASM(0x89, 0xC8);                   // mov eax, ecx
+                break;
+            case OPC_OVER:
+                ASM(0x89, 0x47, 0xFC);             // mov [rdi-4], eax
+                ASM(0x8B, 0x47, 0xF8);             // mov eax, [rdi-8]
+                ASM(0x48, 0x83, 0xC7, 0x04);       // add rdi, 4
+                break;
+            case OPC_ROT:
+                ASM(0x8B, 0x4F, 0xF4);             // mov ecx, [rdi-12]
+                ASM(0x8B, 0x57, 0xF8);             // mov edx, [rdi-8]
+                ASM(0x89, 0x57, 0xF4);             // mov [rdi-12], edx
+                ASM(0x89, 0x47, 0xF8);             // mov [rdi-8], eax
+                ASM(0x89, 0xC8);                   // mov eax, ecx
+                break;
+
+            /* SUPERINSTRUCTIONS */
+            case OPC_DUP_ADD:
+                ASM(0x01, 0xC0);                   // add eax, eax
+                break;
+            case OPC_NIP:
+                ASM(0x48, 0x83, 0xEF, 0x04);       // sub rdi, 4
+                break;
+            case OPC_TWO_DUP:
+                ASM(0x89, 0x47, 0xFC);             // mov [rdi-4], eax
+                ASM(0x8B, 0x4F, 0xF8);             // mov ecx, [rdi-8]
+                ASM(0x89, 0x0F);                   // mov [rdi], ecx
+                ASM(0x48, 0x83, 0xC7, 0x08);       // add rdi, 8
+                break;
+            case OPC_LIT_ADD:
+                ASM(0x05);                         // add eax, imm32
+                emit_imm32(c, ip->value);
+                break;
+            /* the cell index, not its byte offset: from cell 2^29 that no longer fits a disp32 */
+            case OPC_LIT_FETCH:
+                emit_push_tos(c);
+                ASM(0xB9);                         // mov ecx, imm32
+                emit_imm32(c, ip->value);
+                ASM(0x41, 0x8B, 0x04, 0x88);       // mov eax, [r8+rcx*4]
+                break;
+            case OPC_LIT_STORE:
+                ASM(0xB9);                         // mov ecx, imm32
+                emit_imm32(c, ip->value);
+                ASM(0x41, 0x89, 0x04, 0x88);       // mov [r8+rcx*4], eax
+                emit_pop_tos(c);
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+/* each function gets whole pages, which turn read+exec once and stay that way */
+static JitFn place(const Code *c) {
+    if (page_size == 0)
+        page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (c->length + page_size - 1) & ~(page_size - 1);
+    if (arena == NULL || arena_used + size > ARENA_SIZE) {
+        if (size > ARENA_SIZE)
+            return NULL;
+        arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (arena == MAP_FAILED) {
+            arena = NULL;
+            return NULL;
+        }
+        arena_used = 0;
+    }
+    uint8_t *fn = arena + arena_used;
+    memcpy(fn, c->bytes, c->length);
+    if (mprotect(fn, size, PROT_READ | PROT_EXEC) != 0)
+        return NULL;
+    arena_used += size;
+    return (JitFn)(void *)fn;
+}
+
+static JitFn install(const Code *c) {
+    pthread_mutex_lock(&arena_lock);
+    JitFn fn = place(c);
+    pthread_mutex_unlock(&arena_lock);
+    return fn;
+}
+
+/*
+ *  Called once, when a definition reaches JIT_THRESHOLD calls. On failure the
+ *  definition simply stays interpreted.
+ */
+void jit_compile(const DictEntry *entry) {
+    int depth = 0, in = 0, growth = 0;
+    if (!jit_enabled || jit_held || !analyze(entry->func.colon->body, 0, &depth, &in, &growth))
+        return;
+
+    Code code = { 0 };
+    Code *c = &code;
+    ASM(0x89, 0xF0);                       // mov eax, esi
+    ASM(0x49, 0x89, 0xD0);                 // mov r8, rdx
+    translate(c, entry->func.colon->body);
+    ASM(0x89, 0xC2);                       // mov edx, eax
+    ASM(0x48, 0x89, 0xF8);                 // mov rax, rdi
+    ASM(0xC3);                             // ret
+
+    JitFn fn = install(c);
+    free(code.bytes);
+    if (fn == NULL)
+        return;
+
+    struct Native *native = malloc(sizeof(struct Native));
+    if (!native)
+        return;
+    native->fn = fn;
+    native->in = in;
+    native->growth = growth;
+    entry->func.colon->native = native;
+}
+
+#else
+
+void jit_compile(const DictEntry *entry) {
+    (void)entry;
+}
+
+#endif
+
+/* same reports as the interpreter's handlers */
+void jit_fault(long code) {
+    switch (code) {
+        case JIT_FAULT_DIV:     vm_throw(THROW_DIVISION_BY_ZERO, "Division by zero!\n");
+        case JIT_FAULT_MOD:     vm_throw(THROW_DIVISION_BY_ZERO, "Modulo by zero!\n");
+        case JIT_FAULT_DIVMOD:  vm_throw(THROW_DIVISION_BY_ZERO, "/MOD error: Division by zero\n");
+        case JIT_FAULT_FETCH:   vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds at @\n");
+        case JIT_FAULT_STORE:   vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds at !\n");
+        case JIT_FAULT_CFETCH:  vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds in C@\n");
+        case JIT_FAULT_CSTORE:  vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds in C!\n");
+        case JIT_FAULT_DIV_RANGE:    vm_throw(THROW_RESULT_OUT_OF_RANGE, "Division overflow!\n");
+        case JIT_FAULT_MOD_RANGE:    vm_throw(THROW_RESULT_OUT_OF_RANGE, "Modulo overflow!\n");
+        case JIT_FAULT_DIVMOD_RANGE: vm_throw(THROW_RESULT_OUT_OF_RANGE, "/MOD error: Result out of range\n");
+        default:                vm_throw(THROW_UNSUPPORTED, "JIT fault %ld\n", code);
+    }
+}
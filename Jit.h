@@ -0,0 +1,56 @@
+#ifndef JIT_H
+#define JIT_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     x86-64 JIT for hot colon definitions
+ * License:         MIT
+ * Remarks:         native code keeps the top of stack in eax, the stack
+ *                  pointer in rdi and the memory base in r8. It returns the
+ *                  new stack pointer and top of stack, or NULL and a fault code.
+ */
+
+#include "forth.h"
+
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(YAFI_SWITCH_DISPATCH) && !defined(YAFI_NO_JIT) \
+    && !defined(YAFI_PROFILE) && !defined(YAFI_CELL_64)
+#define YAFI_JIT
+#endif
+
+#define JIT_THRESHOLD       64
+#define JIT_INLINE_DEPTH    8
+
+/* only built for 32-bit cells */
+typedef struct {
+    Cell *sp;
+    long tos;
+} JitResult;
+
+typedef JitResult (*JitFn)(Cell *sp, Cell tos, Cell *memory);
+
+struct Native {
+    JitFn fn;
+    int in;         // depth needed on entry
+    int growth;     // most cells pushed above the entry depth
+};
+
+typedef enum {
+    JIT_FAULT_DIV = 1,
+    JIT_FAULT_MOD,
+    JIT_FAULT_DIVMOD,
+    JIT_FAULT_FETCH,
+    JIT_FAULT_STORE,
+    JIT_FAULT_CFETCH,
+    JIT_FAULT_CSTORE,
+    JIT_FAULT_DIV_RANGE,
+    JIT_FAULT_MOD_RANGE,
+    JIT_FAULT_DIVMOD_RANGE
+} JitFault;
+
+extern bool jit_enabled;
+extern _Thread_local bool jit_held;
+
+void jit_compile(const DictEntry *entry);
+void jit_fault(long code);
+
+#endif
@@ -0,0 +1,93 @@
+#include <pthread.h>
+#include <string.h>
+#include "Lexer.h"
+
+/* digit value of each byte in any base up to 36, 0xff for non-digits */
+static uint8_t digits[256];
+static pthread_once_t digits_ready = PTHREAD_ONCE_INIT;
+
+static void init_digits(void) {
+    for (int c = 0; c < 256; c++)
+        digits[c] = 0xff;
+    for (int c = '0'; c <= '9'; c++)
+        digits[c] = (uint8_t)(c - '0');
+    for (int c = 'A'; c <= 'Z'; c++) {
+        digits[c] = (uint8_t)(c - 'A' + 10);
+        digits[c - 'A' + 'a'] = (uint8_t)(c - 'A' + 10);
+    }
+}
+
+static inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+void lexer_begin(Lexer *lexer, const char *text, size_t length) {
+    pthread_once(&digits_ready, init_digits);
+    lexer->cursor = text;
+    lexer->end = text + length;
+}
+
+/*
+ *  One pass per token: every byte is folded into the hash and, while the
+ *  token still looks like a number in 'base', into its value. A leading
+ *  '-' or '+' is allowed; anything else that is not a digit makes it a word.
+ */
+bool next_token(Lexer *lexer, Token *token, int base) {
+    const char *p = lexer->cursor;
+    const char *end = lexer->end;
+
+    while (p < end && is_space(*p))
+        p++;
+    if (p == end || *p == '\0') {
+        lexer->cursor = p;
+        return false;
+    }
+
+    const char *start = p;
+    uint32_t h = HASH_INIT;
+    UCell value = 0;
+    bool negative = false;
+    bool number = true;
+
+    if (*p == '-' || *p == '+') {
+        negative = (*p == '-');
+        h = hash_step(h, *p++);
+        number = (p < end && !is_space(*p) && *p != '\0');
+    }
+    for (; p < end && !is_space(*p) && *p != '\0'; p++) {
+        h = hash_step(h, *p);
+        uint8_t d = digits[(uint8_t)*p];
+        number = number && d < base;
+        value = value * (UCell)base + d;
+    }
+
+    token->start = start;
+    token->length = (int)(p - start);
+    token->hash = h;
+    token->is_number = number;
+    token->value = (Cell)(negative ? 0u - value : value);
+    lexer->cursor = p;
+    return true;
+}
+
+/*
+ *  Raw text for S" and .": the one blank after the word is skipped and the
+ *  text runs up to 'delimiter', which is consumed. Nothing is folded or
+ *  converted; false when the delimiter never comes.
+ */
+bool next_text(Lexer *lexer, char delimiter, const char **text, int *length) {
+    const char *p = lexer->cursor;
+    const char *end = lexer->end;
+
+    if (p < end && is_space(*p))
+        p++;
+    const char *close = memchr(p, delimiter, (size_t)(end - p));
+    if (!close) {
+        lexer->cursor = end;
+        return false;
+    }
+    *text = p;
+    *length = (int)(close - p);
+    lexer->cursor = close + 1;
+    return true;
+}
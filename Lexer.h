@@ -0,0 +1,45 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Single-pass tokenizer: splits, case-folds into the
+ *                  dictionary hash and converts numbers in one scan
+ * License:         MIT
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "Cell.h"
+
+/* FNV-1a over upper-cased bytes, shared with the dictionary */
+#define HASH_INIT   2166136261u
+
+static inline char fold_case(char c) {
+    return (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+}
+
+static inline uint32_t hash_step(uint32_t h, char c) {
+    return (h ^ (uint8_t)fold_case(c)) * 16777619u;
+}
+
+/* a token points into the input buffer; nothing is copied or rewritten */
+typedef struct {
+    const char *start;
+    int length;
+    uint32_t hash;
+    bool is_number;
+    Cell value;
+} Token;
+
+typedef struct {
+    const char *cursor;
+    const char *end;
+} Lexer;
+
+void lexer_begin(Lexer *lexer, const char *text, size_t length);
+bool next_token(Lexer *lexer, Token *token, int base);
+bool next_text(Lexer *lexer, char delimiter, const char **text, int *length);
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     VM memory
+ * License:         MIT
+ *
+ * Memory is one anonymous mapping: zero-filled and only backed by RAM once
+ * touched, so a large size costs nothing up front. It is rounded up to whole
+ * pages, all of them usable, so the user cells end exactly where the mapping
+ * does. The system cells (BASE and the bottom of the string literals) sit
+ * above the user cells. A file,
+ * when given, is mapped shared over the start of it, so @ ! C@ and the bulk
+ * words work on the data in place and stores reach the file; a read-only
+ * file is mapped copy-on-write instead.
+ *
+ * YAFI_GUARDED_MEMORY: the mapping is placed inside a PROT_NONE reservation
+ * covering every byte a 32-bit address can reach from memory, whether the
+ * index is sign-extended (C) or zero-extended (JIT code), times four for
+ * cells: 8 GB below and 16 GB above. A stray address traps, and the SIGSEGV
+ * handler reports it the way the software checks would have. Every VM has
+ * its own reservation; the handler checks the one running on the thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "forth.h"
+#include "Memory.h"
+#include "Vm.h"
+
+#define HUGE_PAGE_SIZE  (2u * 1024 * 1024)
+
+static size_t round_up(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+#ifdef YAFI_GUARDED_MEMORY
+
+#define GUARD_BELOW     ((size_t)8 << 30)
+#define GUARD_ABOVE     ((size_t)16 << 30)
+
+static void on_fault(int sig, siginfo_t *info, void *context) {
+    char *addr = info->si_addr;
+    char *guarded = current_vm ? (char *)current_vm->memory.data : NULL;
+    (void)context;
+    if (guarded && addr >= guarded - GUARD_BELOW && addr < guarded + GUARD_ABOVE) {
+        /* raised by a VM memory access, never from inside stdio, so leaving is safe */
+        vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds at byte offset %td\n", addr - guarded);
+    }
+    /* a genuine crash: let the default action happen when the access repeats */
+    signal(sig, SIG_DFL);
+}
+
+static Cell *map_guarded(size_t bytes) {
+    struct sigaction action;
+
+    char *reservation = mmap(NULL, GUARD_BELOW + GUARD_ABOVE, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reservation == MAP_FAILED) {
+        perror("mmap guard region");
+        return MAP_FAILED;
+    }
+    char *guarded = reservation + GUARD_BELOW;
+    if (mmap(guarded, bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        munmap(reservation, GUARD_BELOW + GUARD_ABOVE);
+        return MAP_FAILED;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_fault;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;     /* vm_throw() jumps out of the handler */
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+    sigaction(SIGBUS, &action, NULL);       /* macOS reports PROT_NONE hits as SIGBUS */
+    return (Cell *)guarded;
+}
+
+#endif
+
+/* false, with the reason on stderr, when the memory or the file cannot be had */
+bool memory_create(Memory *memory, size_t cells, const char *file, bool huge_pages) {
+    int fd = -1;
+    size_t file_bytes = 0;
+    bool writable = true;
+
+    if (file) {
+        struct stat st;
+        fd = open(file, O_RDWR);
+        if (fd < 0) {
+            writable = false;
+            fd = open(file, O_RDONLY);
+        }
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            perror(file);
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+        file_bytes = (size_t)st.st_size;
+        size_t file_cells = round_up(file_bytes, sizeof(Cell)) / sizeof(Cell);
+        cells = (file_cells > cells) ? file_cells : cells;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t total = 0;
+    if (cells > 0 && cells + SYSTEM_CELLS <= MEMORY_MAX_CELLS)
+        total = round_up((cells + SYSTEM_CELLS) * sizeof(Cell), page) / sizeof(Cell);
+    if (total == 0 || total > MEMORY_MAX_CELLS) {
+        fprintf(stderr, "Invalid memory size: %zu cells\n", cells);
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    size_t mapped_bytes = 0;
+    Cell *data = MAP_FAILED;
+
+    /*
+     * Explicit huge pages come from the reserved pool and cannot host a file
+     * mapping; they are reserved up front, so a short pool fails here rather
+     * than with SIGBUS later. Otherwise transparent huge pages are requested.
+     */
+#if defined(MAP_HUGETLB) && !defined(YAFI_GUARDED_MEMORY)
+    if (huge_pages && !file) {
+        mapped_bytes = round_up(total * sizeof(Cell), HUGE_PAGE_SIZE);
+        data = mmap(NULL, mapped_bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (data == MAP_FAILED) {
+        mapped_bytes = round_up(total * sizeof(Cell), page);
+#ifdef YAFI_GUARDED_MEMORY
+        data = map_guarded(mapped_bytes);
+#else
+        data = mmap(NULL, mapped_bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+#endif
+        if (data == MAP_FAILED) {
+            perror("mmap");
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge_pages)
+            madvise(data, mapped_bytes, MADV_HUGEPAGE);
+#endif
+    }
+
+    memory->data = data;
+    memory->cells = (int)total;
+    memory->bytes = mapped_bytes;
+
+    if (fd >= 0) {
+        bool mapped = file_bytes == 0
+            || mmap(data, round_up(file_bytes, page), PROT_READ | PROT_WRITE,
+                    (writable ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED, fd, 0) != MAP_FAILED;
+        if (!mapped)
+            perror(file);
+        close(fd);
+        if (!mapped) {
+            memory_destroy(memory);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ *  An image's memory section, system cells included, mapped copy-on-write
+ *  over fresh memory of the same size: pages come from the page cache as they
+ *  are touched and stay shared with other processes until written.
+ */
+bool memory_load(Memory *memory, size_t cells, int fd, size_t offset) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (cells <= SYSTEM_CELLS || cells > MEMORY_MAX_CELLS || offset % page != 0)
+        return false;
+    if (!memory_create(memory, cells - SYSTEM_CELLS, NULL, false))
+        return false;
+    if (memory->cells != (int)cells) {
+        memory_destroy(memory);
+        return false;
+    }
+    if (mmap(memory->data, round_up(cells * sizeof(Cell), page), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, fd, (off_t)offset) == MAP_FAILED) {
+        memory_destroy(memory);
+        return false;
+    }
+    return true;
+}
+
+void memory_destroy(Memory *memory) {
+    if (memory->data == NULL)
+        return;
+#ifdef YAFI_GUARDED_MEMORY
+    munmap((char *)memory->data - GUARD_BELOW, GUARD_BELOW + GUARD_ABOVE);
+#else
+    munmap(memory->data, memory->bytes);
+#endif
+    memory->data = NULL;
+    memory->bytes = 0;
+}
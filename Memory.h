@@ -0,0 +1,29 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     VM memory: an anonymous mapping of any size, optionally
+ *                  on huge pages, with a file mapped in place at address 0,
+ *                  or with the memory of an image mapped copy-on-write
+ * License:         MIT
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "Cell.h"
+
+/* the largest mapping a 32-bit cell address can reach */
+#define MEMORY_MAX_CELLS    ((size_t)0x7fffffff)
+
+typedef struct {
+    Cell *data;         /* cell 0 */
+    int cells;          /* user cells plus SYSTEM_CELLS */
+    size_t bytes;       /* as mapped, for memory_destroy() */
+} Memory;
+
+bool memory_create(Memory *memory, size_t cells, const char *file, bool huge_pages);
+bool memory_load(Memory *memory, size_t cells, int fd, size_t offset);
+void memory_destroy(Memory *memory);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Buffered output for the IO words
+ * License:         MIT
+ *
+ * All output still goes through stdio, so words, prompts and diagnostics
+ * keep their order; this module only gives stdout a large buffer of our own
+ * and decides when the running VM's stream is written out. FLUSH_SIZE and
+ * FLUSH_EXPLICIT behave the same here: stdio empties a full buffer by itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Output.h"
+#include "Vm.h"
+
+static char buffer[OUTPUT_BUFFER_SIZE];
+
+FlushPolicy output_default_policy(void) {
+    return isatty(STDOUT_FILENO) ? FLUSH_LINE : FLUSH_SIZE;
+}
+
+/* once, before anything is written to stdout */
+void output_init(void) {
+    setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+}
+
+void output_set_policy(FlushPolicy next) {
+    current_vm->policy = next;
+}
+
+void output_flush(void) {
+    fflush(current_vm->out);
+}
+
+/* a VM runs on one thread at a time, so its own stream needs no lock */
+void output_char(int c) {
+    Vm *vm = current_vm;
+    if (vm->shared_out)
+        putc(c, vm->out);
+    else
+        putc_unlocked(c, vm->out);
+    if (c == '\n' && vm->policy == FLUSH_LINE)
+        fflush(vm->out);
+}
+
+void output_bytes(const char *bytes, size_t length) {
+    Vm *vm = current_vm;
+    fwrite(bytes, 1, length, vm->out);
+    if (vm->policy == FLUSH_LINE && memchr(bytes, '\n', length))
+        fflush(vm->out);
+}
+
+/* SPACES and friends: whole blocks instead of one putc per character */
+void output_repeat(int c, size_t count) {
+    Vm *vm = current_vm;
+    char block[256];
+    memset(block, c, count < sizeof(block) ? count : sizeof(block));
+    while (count > 0) {
+        size_t n = count < sizeof(block) ? count : sizeof(block);
+        fwrite(block, 1, n, vm->out);
+        count -= n;
+    }
+    if (c == '\n' && vm->policy == FLUSH_LINE)
+        fflush(vm->out);
+}
+
+/* '.' and '?': format into a local buffer rather than through printf */
+void output_number(Cell value, int base) {
+    char digits[8 * sizeof(Cell) + 2];
+    char *p = digits + sizeof(digits);
+    UCell magnitude = (value < 0) ? -(UCell)value : (UCell)value;
+
+    *--p = '\n';
+    do {
+        *--p = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[magnitude % (unsigned int)base];
+        magnitude /= (unsigned int)base;
+    } while (magnitude);
+    if (value < 0)
+        *--p = '-';
+    output_bytes(p, (size_t)(digits + sizeof(digits) - p));
+}
+
+/* D.: the same at double width, kept apart so '.' does not pay for the wider division */
+void output_double(DCell value, int base) {
+    char digits[8 * sizeof(DCell) + 2];
+    char *p = digits + sizeof(digits);
+    UDCell magnitude = (value < 0) ? -(UDCell)value : (UDCell)value;
+
+    *--p = '\n';
+    do {
+        *--p = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"[magnitude % (unsigned int)base];
+        magnitude /= (unsigned int)base;
+    } while (magnitude);
+    if (value < 0)
+        *--p = '-';
+    output_bytes(p, (size_t)(digits + sizeof(digits) - p));
+}
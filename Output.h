@@ -0,0 +1,34 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Buffered output for the IO words: one large stdout buffer,
+ *                  a flush policy, and bulk paths for TYPE and SPACES.
+ *                  Each VM writes to its own stream with its own policy.
+ * License:         MIT
+ */
+
+#include <stddef.h>
+#include "Cell.h"
+
+#define OUTPUT_BUFFER_SIZE  (64 * 1024)
+
+typedef enum {
+    FLUSH_LINE,         /* after every newline; the default on a terminal */
+    FLUSH_SIZE,         /* only when the buffer is full */
+    FLUSH_EXPLICIT      /* only on FLUSH, before reading input, and at exit */
+} FlushPolicy;
+
+void output_init(void);
+void output_set_policy(FlushPolicy policy);
+FlushPolicy output_default_policy(void);
+void output_flush(void);
+
+void output_char(int c);
+void output_bytes(const char *bytes, size_t length);
+void output_repeat(int c, size_t count);
+void output_number(Cell value, int base);
+void output_double(DCell value, int base);
+
+#endif
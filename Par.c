@@ -0,0 +1,349 @@
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Data-parallel words
+ * License:         MIT
+ *
+ * A range is cut into chunks by its length alone, so a call makes the same
+ * chunks whatever the number of threads. Each thread starts on an equal run
+ * of them and takes chunks from the front of its own run; when that is
+ * empty it steals the back half of another thread's. PAR-REDUCE folds each
+ * chunk from its first cell, then folds init and the chunk results in chunk
+ * order on the calling thread: for an associative word that is the result
+ * of the sequential fold, and always the same one.
+ *
+ * Every thread runs the word in a copy of the caller's VM with stacks of
+ * its own, over the shared memory, and with a catch point of its own: a
+ * THROW or EXIT stops the job and is raised again in the caller once all
+ * threads are done. Output is buffered per thread and written after the
+ * job, thread by thread. The word is JIT-compiled up front where it can be;
+ * nothing is compiled while a job runs, as its threads share the code. A
+ * job started inside a job, or while another VM's job has the pool, runs
+ * on the calling thread alone, in the same chunks.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include "Par.h"
+#include "Engine.h"
+#include "Jit.h"
+
+int par_threads = 0;
+
+/* chunks [next, end) not taken yet */
+typedef struct {
+    pthread_mutex_t lock;
+    int next;
+    int end;
+} Run;
+
+typedef struct {
+    Vm *vm;
+    const DictEntry *entry;
+    const char *word;
+    Cell addr;
+    Cell n;
+    Cell size;                  /* cells per chunk */
+    int chunks;
+    bool reduce;
+    Cell partial[PAR_CHUNKS];   /* PAR-REDUCE: the fold of each chunk */
+    int threads;
+    Run runs[PAR_MAX_THREADS];
+    char *output[PAR_MAX_THREADS];
+    size_t output_length[PAR_MAX_THREADS];
+    pthread_mutex_t lock;       /* the fields below */
+    bool stop;
+    int fault_chunk;            /* the earliest chunk that failed; chunks if none did */
+    int code;
+    bool halted;
+    int status;
+    char error[ERROR_SIZE];
+} Job;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    pthread_mutex_t busy;       /* held by the VM whose job it is */
+    pthread_t threads[PAR_MAX_THREADS];
+    unsigned long born[PAR_MAX_THREADS];
+    int started;                /* threads 1 .. started; the caller is thread 0 */
+    unsigned long generation;   /* one more for every job */
+    Job *job;
+    int working;                /* threads still on the job */
+} Pool;
+
+static Pool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .busy = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static _Thread_local bool in_job = false;
+
+static bool stopped(Job *job) {
+    pthread_mutex_lock(&job->lock);
+    bool stop = job->stop;
+    pthread_mutex_unlock(&job->lock);
+    return stop;
+}
+
+/* the next chunk of this thread's run, else the first of the back half stolen from another's */
+static bool take(Job *job, int self, int *chunk) {
+    Run *own = &job->runs[self];
+    pthread_mutex_lock(&own->lock);
+    bool found = own->next < own->end;
+    if (found)
+        *chunk = own->next++;
+    pthread_mutex_unlock(&own->lock);
+    if (found)
+        return true;
+
+    for (int i = 1; i < job->threads; i++) {
+        Run *victim = &job->runs[(self + i) % job->threads];
+        pthread_mutex_lock(&victim->lock);
+        int from = victim->next + (victim->end - victim->next) / 2;
+        int to = victim->end;
+        if (from < to)
+            victim->end = from;
+        pthread_mutex_unlock(&victim->lock);
+        if (from < to) {
+            pthread_mutex_lock(&own->lock);
+            own->next = from + 1;
+            own->end = to;
+            pthread_mutex_unlock(&own->lock);
+            *chunk = from;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ( x -- y ) or ( a b -- c ) on the thread's own stacks */
+static Cell call(Job *job, Vm *vm, Cell a, Cell b, bool binary) {
+    Stack *stack = &vm->stack;
+    init_stack(stack);
+    init_stack(&vm->return_stack);
+    if (binary)
+        push(stack, a);
+    push(stack, b);
+    execute(job->entry, stack, &vm->return_stack, vm->memory.data);
+    if (stack->top != 1)
+        vm_throw(THROW_INVALID_ARGUMENT, "%s: %s must leave one cell\n", job->word, job->entry->word);
+    return stack->data[0];
+}
+
+static void run_chunk(Job *job, Vm *vm, int chunk) {
+    Cell *memory = vm->memory.data;
+    Cell from = job->addr + (Cell)chunk * job->size;
+    Cell to = (chunk == job->chunks - 1) ? job->addr + job->n : from + job->size;
+
+    if (!job->reduce) {
+        for (Cell i = from; i < to; i++)
+            memory[i] = call(job, vm, 0, memory[i], false);
+        return;
+    }
+    Cell result = memory[from];
+    for (Cell i = from + 1; i < to; i++)
+        result = call(job, vm, result, memory[i], true);
+    job->partial[chunk] = result;
+}
+
+/* of several faults the one in the earliest chunk is kept */
+static void fault(Job *job, Vm *vm, int chunk, int code) {
+    pthread_mutex_lock(&job->lock);
+    job->stop = true;
+    if (chunk < job->fault_chunk) {
+        job->fault_chunk = chunk;
+        job->code = code;
+        job->halted = vm->halted;
+        job->status = vm->status;
+        memcpy(job->error, vm->error, ERROR_SIZE);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void work(Job *job, int self) {
+    Vm copy = *job->vm;
+    Vm *vm = &copy;
+    Vm *outer = current_vm;
+    jmp_buf recover;
+    volatile int chunk = job->chunks;
+    int next;
+
+    vm->catch_frame = NULL;
+    vm->recover = &recover;
+    vm->input = NULL;
+    vm->profile = NULL;
+    vm->halted = false;
+    vm->error[0] = '\0';
+    memset(&vm->tasks, 0, sizeof(Tasks));
+    vm->tasks.running = -1;
+    vm->policy = FLUSH_SIZE;
+    vm->shared_out = false;
+    vm->out = open_memstream(&job->output[self], &job->output_length[self]);
+    if (!vm->out) {
+        fprintf(stderr, "Out of memory in %s\n", job->word);
+        exit(EXIT_FAILURE);
+    }
+    vm_enter(vm);
+    in_job = true;
+    jit_held = true;
+
+    int code = setjmp(recover);
+    if (code != 0)
+        fault(job, vm, chunk, code);
+    while (!stopped(job) && take(job, self, &next)) {
+        chunk = next;
+        run_chunk(job, vm, next);
+    }
+
+    jit_held = false;
+    in_job = false;
+    task_release(vm);
+    fclose(vm->out);
+    if (outer)
+        vm_enter(outer);
+    else
+        current_vm = NULL;
+}
+
+static void *pool_thread(void *arg) {
+    const int self = (int)(intptr_t)arg;
+    pthread_mutex_lock(&pool.lock);
+    unsigned long seen = pool.born[self];
+    while (true) {
+        while (pool.generation == seen)
+            pthread_cond_wait(&pool.start, &pool.lock);
+        seen = pool.generation;
+        Job *job = pool.job;
+        if (self >= job->threads)
+            continue;
+        pthread_mutex_unlock(&pool.lock);
+        work(job, self);
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.working == 0)
+            pthread_cond_signal(&pool.done);
+    }
+    return NULL;
+}
+
+/* threads for a job of this many chunks; the pool is started or grown to match */
+static int start_threads(int chunks) {
+    long wanted = par_threads > 0 ? par_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    if (wanted > PAR_MAX_THREADS)
+        wanted = PAR_MAX_THREADS;
+    if (wanted > chunks)
+        wanted = chunks;
+    while (pool.started < wanted - 1) {
+        int self = pool.started + 1;
+        pool.born[self] = pool.generation;
+        if (pthread_create(&pool.threads[self], NULL, pool_thread, (void *)(intptr_t)self) != 0)
+            break;
+        pthread_detach(pool.threads[self]);
+        pool.started++;
+    }
+    if (wanted > pool.started + 1)
+        wanted = pool.started + 1;
+    return (wanted < 1) ? 1 : (int)wanted;
+}
+
+static void run_job(Job *job) {
+    bool pooled = !in_job && pthread_mutex_trylock(&pool.busy) == 0;
+
+    pthread_mutex_lock(&pool.lock);
+    job->threads = pooled ? start_threads(job->chunks) : 1;
+    for (int i = 0; i < job->threads; i++) {
+        pthread_mutex_init(&job->runs[i].lock, NULL);
+        job->runs[i].next = (int)((long)job->chunks * i / job->threads);
+        job->runs[i].end = (int)((long)job->chunks * (i + 1) / job->threads);
+        job->output[i] = NULL;
+        job->output_length[i] = 0;
+    }
+    if (job->threads > 1) {
+        pool.job = job;
+        pool.working = job->threads - 1;
+        pool.generation++;
+        pthread_cond_broadcast(&pool.start);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    work(job, 0);
+
+    pthread_mutex_lock(&pool.lock);
+    while (job->threads > 1 && pool.working > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    if (pooled)
+        pthread_mutex_unlock(&pool.busy);
+
+    for (int i = 0; i < job->threads; i++) {
+        if (job->output_length[i] > 0)
+            output_bytes(job->output[i], job->output_length[i]);
+        free(job->output[i]);
+        pthread_mutex_destroy(&job->runs[i].lock);
+    }
+}
+
+static void start_job(Job *job, Vm *vm, const DictEntry *entry, const char *word, Cell addr, Cell n) {
+    job->vm = vm;
+    job->entry = entry;
+    job->word = word;
+    job->addr = addr;
+    job->n = n;
+    job->size = (n + PAR_CHUNKS - 1) / PAR_CHUNKS;
+    if (job->size < PAR_MIN_CHUNK)
+        job->size = PAR_MIN_CHUNK;
+    job->chunks = (int)((n + job->size - 1) / job->size);
+    job->reduce = false;
+    pthread_mutex_init(&job->lock, NULL);
+    job->stop = false;
+    job->fault_chunk = job->chunks;
+    job->error[0] = '\0';
+
+    if (entry->type == OP_COLON && !entry->func.colon->native)
+        jit_compile(entry);
+}
+
+/* after the threads have stopped: the fault of the earliest failed chunk, if any */
+static void end_job(Job *job) {
+    pthread_mutex_destroy(&job->lock);
+    if (job->fault_chunk == job->chunks)
+        return;
+    if (job->halted)
+        vm_stop(job->status);
+    if (job->error[0])
+        vm_throw(job->code, "%s", job->error);
+    vm_throw(job->code, NULL);
+}
+
+void par_map(Vm *vm, const DictEntry *entry, Cell addr, Cell n) {
+    Job job;
+    if (n == 0)
+        return;
+    start_job(&job, vm, entry, PARMAP, addr, n);
+    run_job(&job);
+    end_job(&job);
+}
+
+Cell par_reduce(Vm *vm, const DictEntry *entry, Stack *stack, Stack *return_stack, Cell addr, Cell n, Cell init) {
+    Job job;
+    if (n == 0)
+        return init;
+    start_job(&job, vm, entry, PARREDUCE, addr, n);
+    job.reduce = true;
+    run_job(&job);
+    end_job(&job);
+
+    Cell result = init;
+    for (int i = 0; i < job.chunks; i++) {
+        int depth = stack->top;
+        push(stack, result);
+        push(stack, job.partial[i]);
+        execute(entry, stack, return_stack, vm->memory.data);
+        if (stack->top != depth + 1)
+            vm_throw(THROW_INVALID_ARGUMENT, "%s: %s must leave one cell\n", PARREDUCE, entry->word);
+        result = pop(stack);
+    }
+    return result;
+}
@@ -0,0 +1,24 @@
+#ifndef PAR_H
+#define PAR_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     PAR-MAP and PAR-REDUCE: one word over a range of VM
+ *                  memory, in chunks, on a work-stealing pool of threads
+ * License:         MIT
+ */
+
+#include "Vm.h"
+
+#define PAR_MAX_THREADS 64
+#define PAR_CHUNKS      256     /* a range is cut into at most this many chunks */
+#define PAR_MIN_CHUNK   64      /* of at least this many cells, but for the last */
+
+/* threads a job runs on, the caller's included; 0 is one per online core */
+extern int par_threads;
+
+/* both THROW what the word threw, after every thread has stopped; the final fold runs on the caller's stacks */
+void par_map(Vm *vm, const DictEntry *entry, Cell addr, Cell n);
+Cell par_reduce(Vm *vm, const DictEntry *entry, Stack *stack, Stack *return_stack, Cell addr, Cell n, Cell init);
+
+#endif
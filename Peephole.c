@@ -0,0 +1,169 @@
+#include "Peephole.h"
+#include "Engine.h"
+#include "Vm.h"
+
+/* superinstructions: only the direct-dispatch engine has handlers for them */
+const DictEntry word_dup_add   = { "DUP +",     OP_SUPER, {NULL}, OPC_DUP_ADD,   1, 1 };
+const DictEntry word_nip       = { "SWAP DROP", OP_SUPER, {NULL}, OPC_NIP,       2, 1 };
+const DictEntry word_two_dup   = { "OVER OVER", OP_SUPER, {NULL}, OPC_TWO_DUP,   2, 4 };
+const DictEntry word_lit_add   = { "LIT +",     OP_SUPER, {NULL}, OPC_LIT_ADD,   1, 1 };
+const DictEntry word_lit_fetch = { "LIT @",     OP_SUPER, {NULL}, OPC_LIT_FETCH, 0, 1 };
+const DictEntry word_lit_store = { "LIT !",     OP_SUPER, {NULL}, OPC_LIT_STORE, 1, 0 };
+
+static const char *fusion_names[FUSION_COUNT] = {
+    [FOLD_BINARY]       = "<lit> <lit> <op>  -> <lit>",
+    [FOLD_UNARY]        = "<lit> <op>        -> <lit>",
+    [FUSE_DUP_ADD]      = "DUP +             -> DUP+",
+    [FUSE_NIP]          = "SWAP DROP         -> NIP",
+    [FUSE_TWO_DUP]      = "OVER OVER         -> 2DUP",
+    [FUSE_LIT_ADD]      = "<lit> +           -> LIT+",
+    [FUSE_LIT_SUB]      = "<lit> -           -> LIT+",
+    [FUSE_LIT_ADD_ADD]  = "LIT+ LIT+         -> LIT+",
+    [FUSE_LIT_FETCH]    = "<lit> @           -> LIT@",
+    [FUSE_LIT_STORE]    = "<lit> !           -> LIT!",
+    [FUSE_ZERO_BRANCH]  = "0= IF/UNTIL/WHILE -> branch on true",
+};
+
+static void set(Instr *instr, const DictEntry *entry, Cell value) {
+    instr->op = entry->opcode;
+    instr->in = entry->in;
+    instr->out = entry->out;
+    instr->value = value;
+    instr->entry = entry;
+}
+
+/* same results as the engine handlers; division by zero is left to fail at runtime */
+static bool fold_binary(Opcode op, Cell a, Cell b, Cell *result) {
+    switch (op) {
+        case OPC_ADD:           *result = (Cell)((UCell)a + (UCell)b); return true;
+        case OPC_SUB:           *result = (Cell)((UCell)a - (UCell)b); return true;
+        case OPC_MUL:           *result = (Cell)((UCell)a * (UCell)b); return true;
+        case OPC_DIV:
+            if (b == 0 || (a == CELL_MIN && b == -1))
+                return false;
+            *result = a / b;
+            return true;
+        case OPC_MOD:
+            if (b == 0 || (a == CELL_MIN && b == -1))
+                return false;
+            *result = a % b;
+            return true;
+        case OPC_AND:           *result = a & b; return true;
+        case OPC_OR:            *result = a | b; return true;
+        case OPC_XOR:           *result = a ^ b; return true;
+        case OPC_MAX:           *result = (a > b) ? a : b; return true;
+        case OPC_MIN:           *result = (a < b) ? a : b; return true;
+        case OPC_LESS_THAN:     *result = (a < b) ? -1 : 0; return true;
+        case OPC_EQUAL:         *result = (a == b) ? -1 : 0; return true;
+        case OPC_GREATER_THAN:  *result = (a > b) ? -1 : 0; return true;
+        default:                return false;
+    }
+}
+
+static bool fold_unary(Opcode op, Cell a, Cell *result) {
+    switch (op) {
+        case OPC_ONE_PLUS:      *result = (Cell)((UCell)a + 1); return true;
+        case OPC_ONE_MINUS:     *result = (Cell)((UCell)a - 1); return true;
+        case OPC_TWO_PLUS:      *result = (Cell)((UCell)a + 2); return true;
+        case OPC_TWO_MINUS:     *result = (Cell)((UCell)a - 2); return true;
+        case OPC_NEGATE:        *result = (Cell)(0u - (UCell)a); return true;
+        case OPC_ABS:           *result = (a < 0) ? (Cell)(0u - (UCell)a) : a; return true;
+        case OPC_NOT:           *result = ~a; return true;
+        case OPC_ZERO_LESS:     *result = (a < 0) ? -1 : 0; return true;
+        case OPC_ZERO_EQUAL:    *result = (a == 0) ? -1 : 0; return true;
+        case OPC_ZERO_GREATER:  *result = (a > 0) ? -1 : 0; return true;
+        default:                return false;
+    }
+}
+
+/*
+ *  Tries one rewrite on the last instructions of out[0..n). Returns the new
+ *  length, or n when nothing matched.
+ */
+static int rewrite_tail(Instr *out, int n) {
+    Instr *last = &out[n - 1];
+    Instr *prev = (n >= 2) ? &out[n - 2] : NULL;
+    Instr *prev2 = (n >= 3) ? &out[n - 3] : NULL;
+    Cell result;
+
+    if (prev2 && prev2->op == OPC_LIT && prev->op == OPC_LIT
+            && fold_binary(last->op, prev2->value, prev->value, &result)) {
+        set(prev2, &word_lit, result);
+        current_vm->fusions[FOLD_BINARY]++;
+        return n - 2;
+    }
+    if (prev && prev->op == OPC_LIT && fold_unary(last->op, prev->value, &result)) {
+        set(prev, &word_lit, result);
+        current_vm->fusions[FOLD_UNARY]++;
+        return n - 1;
+    }
+
+#ifndef YAFI_SWITCH_DISPATCH
+    if (prev == NULL)
+        return n;
+
+    if (prev->op == OPC_DUP && last->op == OPC_ADD) {
+        set(prev, &word_dup_add, 0);
+        current_vm->fusions[FUSE_DUP_ADD]++;
+        return n - 1;
+    }
+    if (prev->op == OPC_SWAP && last->op == OPC_DROP) {
+        set(prev, &word_nip, 0);
+        current_vm->fusions[FUSE_NIP]++;
+        return n - 1;
+    }
+    if (prev->op == OPC_OVER && last->op == OPC_OVER) {
+        set(prev, &word_two_dup, 0);
+        current_vm->fusions[FUSE_TWO_DUP]++;
+        return n - 1;
+    }
+    if (prev->op == OPC_LIT && last->op == OPC_ADD) {
+        set(prev, &word_lit_add, prev->value);
+        current_vm->fusions[FUSE_LIT_ADD]++;
+        return n - 1;
+    }
+    if (prev->op == OPC_LIT && last->op == OPC_SUB) {
+        set(prev, &word_lit_add, (Cell)(0u - (UCell)prev->value));
+        current_vm->fusions[FUSE_LIT_SUB]++;
+        return n - 1;
+    }
+    if (prev->op == OPC_LIT_ADD && last->op == OPC_LIT_ADD) {
+        set(prev, &word_lit_add, (Cell)((UCell)prev->value + (UCell)last->value));
+        current_vm->fusions[FUSE_LIT_ADD_ADD]++;
+        return n - 1;
+    }
+    /* the address is known here, so the handlers skip the bounds check */
+    if (prev->op == OPC_LIT && last->op == OPC_FETCH
+            && prev->value >= 0 && prev->value < memory_cells) {
+        set(prev, &word_lit_fetch, prev->value);
+        current_vm->fusions[FUSE_LIT_FETCH]++;
+        return n - 1;
+    }
+    if (prev->op == OPC_LIT && last->op == OPC_STORE
+            && prev->value >= 0 && prev->value < memory_cells) {
+        set(prev, &word_lit_store, prev->value);
+        current_vm->fusions[FUSE_LIT_STORE]++;
+        return n - 1;
+    }
+#endif
+
+    return n;
+}
+
+/* rewrites code in place, re-examining the tail after every match so rewrites cascade */
+int peephole(Instr *code, int length) {
+    int n = 0;
+    for (int i = 0; i < length; i++) {
+        code[n++] = code[i];
+        int m;
+        while ((m = rewrite_tail(code, n)) != n)
+            n = m;
+    }
+    return n;
+}
+
+void peephole_report(FILE *out) {
+    for (int i = 0; i < FUSION_COUNT; i++) {
+        fprintf(out, "%s : %lu\n", fusion_names[i], current_vm->fusions[i]);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Peephole pass over compiled threaded code: constant
+ *                  folding and fusion of common sequences into superinstructions
+ * License:         MIT
+ */
+
+#include "forth.h"
+
+/* rewrites counted per VM for .FUSIONS */
+typedef enum {
+    FOLD_BINARY,
+    FOLD_UNARY,
+    FUSE_DUP_ADD,
+    FUSE_NIP,
+    FUSE_TWO_DUP,
+    FUSE_LIT_ADD,
+    FUSE_LIT_SUB,
+    FUSE_LIT_ADD_ADD,
+    FUSE_LIT_FETCH,
+    FUSE_LIT_STORE,
+    FUSE_ZERO_BRANCH,
+    FUSION_COUNT
+} Fusion;
+
+/* the superinstructions the pass emits */
+extern const DictEntry word_dup_add;
+extern const DictEntry word_nip;
+extern const DictEntry word_two_dup;
+extern const DictEntry word_lit_add;
+extern const DictEntry word_lit_fetch;
+extern const DictEntry word_lit_store;
+
+int peephole(Instr *code, int length);
+void peephole_report(FILE *out);
+
+#endif
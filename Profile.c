@@ -0,0 +1,123 @@
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Per-word profiler
+ * License:         MIT
+ *
+ * The profile is a tree of call paths. In a YAFI_PROFILE build the inner
+ * interpreter steps it before every instruction: the time since the last
+ * step goes to the word that was running, and a colon call descends into
+ * its own node. Without YAFI_PROFILE nothing in the interpreter refers to
+ * it and the PROFILE words only say so. Every node is written twice as a
+ * folded stack, "YAFI;CALLER;WORD value": time in PATH, executions in
+ * PATH.calls.
+ */
+
+#include "Profile.h"
+
+#define PROFILE_ROOT    "YAFI"
+
+ProfileNode *profile_child(ProfileNode *parent, const DictEntry *entry) {
+    ProfileNode **link = &parent->children;
+    for (ProfileNode *node = *link; node; link = &node->next, node = *link) {
+        if (node->entry == entry) {
+            /* the hottest child comes first next time */
+            *link = node->next;
+            node->next = parent->children;
+            parent->children = node;
+            return node;
+        }
+    }
+
+    ProfileNode *node = calloc(1, sizeof(ProfileNode));
+    if (!node) {
+        fprintf(stderr, "Out of memory profiling\n");
+        exit(EXIT_FAILURE);
+    }
+    node->entry = entry;
+    node->parent = parent;
+    node->next = parent->children;
+    parent->children = node;
+    return node;
+}
+
+Profile *profile_create(void) {
+    Profile *profile = calloc(1, sizeof(Profile));
+    if (!profile) {
+        fprintf(stderr, "Out of memory profiling\n");
+        exit(EXIT_FAILURE);
+    }
+    profile->frame = &profile->root;
+    profile->current = &profile->root;
+    return profile;
+}
+
+static void free_children(ProfileNode *node) {
+    ProfileNode *child = node->children;
+    while (child) {
+        ProfileNode *next = child->next;
+        free_children(child);
+        free(child);
+        child = next;
+    }
+}
+
+void profile_destroy(Profile *profile) {
+    if (!profile)
+        return;
+    free_children(&profile->root);
+    free(profile);
+}
+
+void profile_start(Profile *profile) {
+    profile->last = profile_clock();
+    profile->on = true;
+}
+
+void profile_stop(Profile *profile) {
+    profile->current->ticks += profile_clock() - profile->last;
+    profile->on = false;
+}
+
+/* CATCH or the outer interpreter took over from frame's callees */
+void profile_unwind(Profile *profile, ProfileNode *frame) {
+    profile->frame = frame;
+    profile->current = frame;
+}
+
+/* path holds the names from the root down to node, separated by ';' */
+static void write_node(const ProfileNode *node, char *path, size_t length, FILE *ticks, FILE *calls) {
+    if (node->ticks)
+        fprintf(ticks, "%.*s %llu\n", (int)length, path, (unsigned long long)node->ticks);
+    if (node->count)
+        fprintf(calls, "%.*s %lu\n", (int)length, path, node->count);
+
+    for (const ProfileNode *child = node->children; child; child = child->next) {
+        size_t name = strlen(child->entry->word);
+        char *longer = malloc(length + 1 + name);
+        if (!longer)
+            return;
+        memcpy(longer, path, length);
+        longer[length] = ';';
+        memcpy(longer + length + 1, child->entry->word, name);
+        write_node(child, longer, length + 1 + name, ticks, calls);
+        free(longer);
+    }
+}
+
+bool profile_write(const Profile *profile, const char *path) {
+    char calls_path[FILENAME_MAX];
+    snprintf(calls_path, sizeof(calls_path), "%s.calls", path);
+
+    FILE *ticks = fopen(path, "w");
+    FILE *calls = ticks ? fopen(calls_path, "w") : NULL;
+    if (!ticks || !calls) {
+        perror(ticks ? calls_path : path);
+        if (ticks)
+            fclose(ticks);
+        return false;
+    }
+    char root[] = PROFILE_ROOT;
+    write_node(&profile->root, root, strlen(root), ticks, calls);
+    bool ok = !ferror(ticks) && !ferror(calls);
+    return (fclose(ticks) == 0) & (fclose(calls) == 0) && ok;
+}
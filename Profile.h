@@ -0,0 +1,80 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Per-word profiler (make PROFILE=yes): execution counts
+ *                  and time per word and call path, written as folded
+ *                  stacks for flamegraph.pl
+ * License:         MIT
+ */
+
+#include <stdint.h>
+#include <time.h>
+#include "forth.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* one node per call path: the word, and the chain of colon definitions above it */
+typedef struct ProfileNode {
+    const DictEntry *entry;
+    struct ProfileNode *parent;
+    struct ProfileNode *children;
+    struct ProfileNode *next;
+    unsigned long count;
+    uint64_t ticks;             /* spent in this word itself, not in its callees */
+} ProfileNode;
+
+typedef struct {
+    ProfileNode root;           /* the outer interpreter */
+    ProfileNode *frame;         /* definition being run */
+    ProfileNode *current;       /* word being run, charged until the next step */
+    uint64_t last;
+    bool on;
+} Profile;
+
+/* TSC cycles where there is one, else nanoseconds */
+static inline uint64_t profile_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+ProfileNode *profile_child(ProfileNode *parent, const DictEntry *entry);
+
+/* called by the inner interpreter before each instruction; a call enters the callee's frame */
+static inline void profile_step(Profile *profile, const Instr *instr) {
+    uint64_t now = profile_clock();
+    profile->current->ticks += now - profile->last;
+    profile->last = now;
+    if (instr->op == OPC_RET) {
+        profile->current = profile->frame;
+        return;
+    }
+    ProfileNode *node = profile_child(profile->frame, instr->entry);
+    node->count++;
+    profile->current = node;
+    if (instr->op == OPC_CALL)
+        profile->frame = node;
+}
+
+/* after the return out of a colon definition */
+static inline void profile_return(Profile *profile) {
+    if (profile->frame->parent)
+        profile->frame = profile->frame->parent;
+}
+
+Profile *profile_create(void);
+void profile_destroy(Profile *profile);
+void profile_start(Profile *profile);
+void profile_stop(Profile *profile);
+void profile_unwind(Profile *profile, ProfileNode *frame);
+bool profile_write(const Profile *profile, const char *path);
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Script runner
+ * License:         MIT
+ *
+ * A runtime error or EXIT stops the script, not the process: each line
+ * runs through vm_eval(). In parallel every script gets a fresh
+ * VM whose output is collected in memory; the scripts are handed out to
+ * the workers in order and their output is written in order, each script
+ * as soon as it and all scripts before it are done. Diagnostics go to
+ * stderr directly.
+ *
+ * Reading a line is where SPAWNed tasks run: a round before each line, and
+ * more while the line has not arrived. At the end of the input the tasks
+ * still running are run to their end.
+ */
+
+#include <pthread.h>
+#include "Runner.h"
+
+typedef struct {
+    const char *path;
+    char *output;
+    size_t length;
+    bool ok;
+    bool done;
+} Job;
+
+typedef struct {
+    Job *jobs;
+    int count;
+    int next;                   /* first job not handed out yet */
+    const VmConfig *config;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} Pool;
+
+/* the tasks' turn before the next line is read; false once one of them EXITs */
+bool run_tasks(Vm *vm, Source *source) {
+    bool running = vm_run_tasks(vm, false);
+    while (running && vm->tasks.live > 0 && !source_ready(source))
+        running = vm_run_tasks(vm, false);
+    return running;
+}
+
+/*
+ *  Batch: no banner, prompt or stack echo; stop at the first failing line
+ */
+bool run_script(Vm *vm, const char *path) {
+    Source source;
+    const char *line;
+    size_t length;
+
+    if (!source_open(&source, path))
+        return false;
+
+    bool ok = true;
+    while (ok && run_tasks(vm, &source) && source_next_line(&source, &line, &length))
+        ok = vm_eval(vm, line, length);
+    if (ok)
+        vm_run_tasks(vm, true);
+    if (!ok) {
+        fflush(vm->out);
+        fprintf(stderr, "%s:%d: error\n", source.name, source.line);
+    }
+    return source_close(&source) && ok;
+}
+
+static void run_job(const VmConfig *shared, Job *job) {
+    VmConfig config = *shared;
+    FILE *out = open_memstream(&job->output, &job->length);
+    if (!out) {
+        perror(job->path);
+        job->ok = false;
+        return;
+    }
+    config.out = out;
+    config.policy = FLUSH_SIZE;
+
+    Vm *vm = vm_create(&config);
+    if (!vm) {
+        job->ok = false;
+        fclose(out);
+        return;
+    }
+    vm_enter(vm);
+    job->ok = run_script(vm, job->path);
+    if (job->ok && !vm->halted && is_compiling()) {
+        fprintf(stderr, "%s: unterminated definition at end of input\n", job->path);
+        job->ok = false;
+    }
+    vm_destroy(vm);
+    fclose(out);
+}
+
+static void *worker(void *arg) {
+    Pool *pool = arg;
+    while (true) {
+        pthread_mutex_lock(&pool->lock);
+        int i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if (i >= pool->count)
+            return NULL;
+
+        run_job(pool->config, &pool->jobs[i]);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->jobs[i].done = true;
+        pthread_cond_broadcast(&pool->finished);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+bool run_parallel(char **paths, int count, int jobs, const VmConfig *config) {
+    Pool pool = { .count = count, .config = config };
+    pthread_t *threads = calloc((size_t)jobs, sizeof(pthread_t));
+    pool.jobs = calloc((size_t)count, sizeof(Job));
+    if (!threads || !pool.jobs) {
+        fprintf(stderr, "Out of memory starting %d jobs\n", jobs);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++)
+        pool.jobs[i].path = paths[i];
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.finished, NULL);
+
+    int started = 0;
+    while (started < jobs && started < count) {
+        if (pthread_create(&threads[started], NULL, worker, &pool) != 0)
+            break;
+        started++;
+    }
+    if (started == 0) {
+        fprintf(stderr, "Cannot start worker threads\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        Job *job = &pool.jobs[i];
+        pthread_mutex_lock(&pool.lock);
+        while (!job->done)
+            pthread_cond_wait(&pool.finished, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+
+        fwrite(job->output, 1, job->length, stdout);
+        fflush(stdout);
+        free(job->output);
+        ok = ok && job->ok;
+    }
+
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&pool.finished);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.jobs);
+    free(threads);
+    return ok;
+}
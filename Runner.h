@@ -0,0 +1,18 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Script runner: one script in a VM, or many scripts in
+ *                  parallel, each in its own VM, on a pool of threads
+ * License:         MIT
+ */
+
+#include "Vm.h"
+#include "Source.h"
+
+bool run_tasks(Vm *vm, Source *source);
+bool run_script(Vm *vm, const char *path);
+bool run_parallel(char **paths, int count, int jobs, const VmConfig *config);
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Source input of any size
+ * License:         MIT
+ *
+ * Lines are handed out as (pointer, length) into the mapping or the read
+ * buffer and stay valid until the next call. Only whole lines are returned,
+ * so no token is ever split: a line that does not fit yet is moved to the
+ * front of the buffer, which doubles when one line fills all of it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Source.h"
+
+/* "-" is stdin */
+bool source_open(Source *source, const char *path) {
+    bool from_stdin = (strcmp(path, "-") == 0);
+    struct stat st;
+
+    memset(source, 0, sizeof(*source));
+    source->name = from_stdin ? "<stdin>" : path;
+    source->fd = from_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+    if (source->fd < 0) {
+        perror(path);
+        return false;
+    }
+
+    /* from the current position: a shell may have handed over stdin part way through */
+    off_t offset = lseek(source->fd, 0, SEEK_CUR);
+    if (fstat(source->fd, &st) == 0 && S_ISREG(st.st_mode) && offset >= 0 && offset < st.st_size) {
+        off_t start = offset & ~((off_t)sysconf(_SC_PAGESIZE) - 1);
+        size_t size = (size_t)(st.st_size - start);
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, source->fd, start);
+        if (map != MAP_FAILED) {
+            madvise(map, size, MADV_SEQUENTIAL);
+            source->data = map;
+            source->size = size;
+            source->position = (size_t)(offset - start);
+            source->mapped = true;
+            source->eof = true;
+            lseek(source->fd, 0, SEEK_END);     /* consumed, as read() would leave it */
+            return true;
+        }
+    }
+
+    source->capacity = SOURCE_CHUNK;
+    source->data = malloc(source->capacity);
+    if (!source->data) {
+        fprintf(stderr, "Out of memory reading %s\n", source->name);
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+/* keep the unfinished line, make room behind it, and read() as much as fits */
+static void refill(Source *source) {
+    size_t rest = source->size - source->position;
+    memmove(source->data, source->data + source->position, rest);
+    source->size = rest;
+    source->position = 0;
+
+    if (source->size == source->capacity) {
+        source->capacity *= 2;
+        source->data = realloc(source->data, source->capacity);
+        if (!source->data) {
+            fprintf(stderr, "Out of memory reading %s\n", source->name);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    ssize_t n;
+    do {
+        n = read(source->fd, source->data + source->size, source->capacity - source->size);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        perror(source->name);
+        source->failed = true;
+        source->eof = true;
+    } else if (n == 0) {
+        source->eof = true;
+    } else {
+        source->size += (size_t)n;
+    }
+}
+
+bool source_next_line(Source *source, const char **line, size_t *length) {
+    while (true) {
+        const char *start = source->data + source->position;
+        size_t available = source->size - source->position;
+        const char *newline = memchr(start, '\n', available);
+
+        if (newline || (source->eof && available > 0)) {
+            *line = start;
+            *length = newline ? (size_t)(newline - start + 1) : available;
+            source->position += *length;
+            source->line++;
+            return true;
+        }
+        if (source->eof)
+            return false;
+        refill(source);
+    }
+}
+
+/* whether source_next_line() would return without waiting for input */
+bool source_ready(Source *source) {
+    if (source->eof || memchr(source->data + source->position, '\n', source->size - source->position))
+        return true;
+    struct pollfd input = { .fd = source->fd, .events = POLLIN };
+    return poll(&input, 1, 0) > 0;
+}
+
+/* false when reading failed part way */
+bool source_close(Source *source) {
+    if (source->mapped)
+        munmap(source->data, source->size);
+    else
+        free(source->data);
+    if (source->fd != STDIN_FILENO)
+        close(source->fd);
+    source->data = NULL;
+    return !source->failed;
+}
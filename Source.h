@@ -0,0 +1,34 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Source input of any size: regular files are mapped,
+ *                  pipes and terminals are read in large chunks
+ * License:         MIT
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SOURCE_CHUNK    (64 * 1024)
+
+typedef struct {
+    const char *name;
+    int fd;
+    char *data;         /* the mapped file, or the read buffer */
+    size_t size;        /* bytes of data that are valid */
+    size_t capacity;    /* size of the read buffer; 0 when mapped */
+    size_t position;    /* start of the next line */
+    bool mapped;
+    bool eof;
+    bool failed;
+    int line;           /* number of the line last returned */
+} Source;
+
+bool source_open(Source *source, const char *path);
+bool source_next_line(Source *source, const char **line, size_t *length);
+bool source_ready(Source *source);
+bool source_close(Source *source);
+
+#endif
@@ -1,25 +1,23 @@
 #include "Stack.h"
+#include "Vm.h"
 
-void push(Stack *s, int value) {
+void push(Stack *s, Cell value) {
     if (s->top >= STACK_SIZE) {
-        fprintf(stderr, "Stack overflow!\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_STACK_OVERFLOW, "Stack overflow!\n");
     }
     s->data[s->top++] = value;
 }
 
-int pop(Stack *s) {
+Cell pop(Stack *s) {
     if (s->top == 0) {
-        fprintf(stderr, "Stack underflow!\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_STACK_UNDERFLOW, "Stack underflow!\n");
     }
     return s->data[--s->top];
 }
 
-int peek(Stack *s) {
+Cell peek(Stack *s) {
     if (s->top == 0) {
-        fprintf(stderr, "Stack empty!\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_STACK_UNDERFLOW, "Stack empty!\n");
     }
     return s->data[s->top - 1];
 }
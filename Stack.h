@@ -4,17 +4,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include "Cell.h"
 
 #define STACK_SIZE 1024
 
 typedef struct {
-    int data[STACK_SIZE];
+    Cell floor;     // scratch cell under data[0]: native code spills a cached top of stack here when empty
+    Cell data[STACK_SIZE];
     int top;
 } Stack;
 
-void push(Stack *s, int value);
-int pop(Stack *s);
-int peek(Stack *s);
+void push(Stack *s, Cell value);
+Cell pop(Stack *s);
+Cell peek(Stack *s);
 
 void init_stack(Stack *s);
 bool stack_has_min_depth(Stack *s, int n);
@@ -0,0 +1,192 @@
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Cooperative tasks
+ * License:         MIT
+ *
+ * SPAWN gives a word its own data and return stack and a user area, and
+ * puts it in the next free slot. Tasks run only inside PAUSE: a round
+ * resumes every other live task once, in slot order after the one that
+ * paused, and returns. The interpreter takes part too: it runs a round
+ * whenever it reads a line, and keeps running rounds while the next line
+ * has not arrived, so waiting for input is time the tasks get.
+ *
+ * A task that pauses from the word it was spawned with leaves its engine
+ * registers in its Resume and returns to the round; switching is those few
+ * stores and loads, no C stack is kept. A PAUSE further down, under
+ * EXECUTE or CATCH, runs the round from where it is instead, and the task
+ * is skipped until it returns. A fault no CATCH in the task takes is
+ * reported and ends that task only.
+ */
+
+#include "Task.h"
+#include "Vm.h"
+
+/* cell-aligned cells below string space, which moves down past them */
+static Cell allocate_user(Cell *memory) {
+    Cell at = strings_bottom(memory) / (Cell)sizeof(Cell) - USER_CELLS;
+    if (at < 0)
+        vm_throw(THROW_DICTIONARY_OVERFLOW, "Out of memory for a user area\n");
+    memory[STRINGS_CELL] = at * (Cell)sizeof(Cell);
+    return at;
+}
+
+static Task *free_slot(Vm *vm) {
+    Tasks *tasks = &vm->tasks;
+    for (int i = 0; i < tasks->count; i++) {
+        if (!tasks->slots[i]->live && !tasks->slots[i]->active)
+            return tasks->slots[i];
+    }
+    Cell user = allocate_user(vm->memory.data);
+    Task **slots = realloc(tasks->slots, (size_t)(tasks->count + 1) * sizeof(Task *));
+    Task *task = calloc(1, sizeof(Task));
+    if (!slots || !task) {
+        fprintf(stderr, "Out of memory in SPAWN\n");
+        exit(EXIT_FAILURE);
+    }
+    task->user = user;
+    tasks->slots = slots;
+    tasks->slots[tasks->count++] = task;
+    return task;
+}
+
+/* x is all the new task's stack holds; it first runs at the next PAUSE */
+void task_spawn(Vm *vm, const DictEntry *entry, Cell x) {
+    Task *task = free_slot(vm);
+
+    init_stack(&task->stack);
+    init_stack(&task->return_stack);
+    push(&task->stack, x);
+    task->start[0] = (Instr){ .op = entry->opcode, .in = entry->in, .out = entry->out, .entry = entry };
+    task->start[1] = (Instr){ .op = OPC_RET, .entry = &word_ret };
+    task->resume.ip = task->start;
+    task->resume.rp = 0;
+    task->resume.lp = 0;
+    task->resume.index = 0;
+    task->resume.limit = 0;
+    memset(vm->memory.data + task->user, 0, USER_CELLS * sizeof(Cell));
+    task->profile_frame = NULL;
+    task->live = true;
+    vm->tasks.live++;
+}
+
+static void end_task(Tasks *tasks, Task *task) {
+    task->active = false;
+    if (task->live) {
+        task->live = false;
+        tasks->live--;
+    }
+}
+
+/* until its next PAUSE or its end; each task has its own call path in the profile */
+static void resume(Vm *vm, Task *task) {
+    Profile *profile = vm->profile;
+    ProfileNode *frame = NULL;
+    if (profile) {
+        frame = profile->frame;
+        profile_unwind(profile, task->profile_frame ? task->profile_frame : &profile->root);
+    }
+    task->active = true;
+    bool paused = resume_task(&task->resume, &task->stack, &task->return_stack, vm->memory.data);
+    task->active = false;
+    if (!paused)
+        end_task(&vm->tasks, task);
+    if (profile) {
+        task->profile_frame = profile->frame;
+        profile_unwind(profile, frame);
+    }
+}
+
+/* one round: every other live task runs once, those spawned during it wait for the next */
+void task_pause(Vm *vm) {
+    Tasks *tasks = &vm->tasks;
+    if (tasks->live == 0 || (tasks->live == 1 && tasks->running >= 0))
+        return;
+
+    CatchFrame guard = { .outer = NULL };
+    CatchFrame *frame = vm->catch_frame;
+    CatchFrame *outer = tasks->guard;
+    ProfileNode *profile_frame = vm->profile ? vm->profile->frame : NULL;
+    const int self = tasks->running;
+    const int count = tasks->count;
+    volatile int turn = 0;
+
+    int code = setjmp(guard.jump);
+    if (code != 0) {
+        Task *task = tasks->slots[tasks->running];
+        if (!tasks->stopping) {
+            fflush(vm->out);
+            fprintf(stderr, "Task %d: ", tasks->running);
+            vm_report(vm, code);
+        }
+        tasks->stopping = false;
+        end_task(tasks, task);
+        task->profile_frame = NULL;
+        if (vm->profile)
+            profile_unwind(vm->profile, profile_frame ? profile_frame : &vm->profile->root);
+    }
+    while (turn < count) {
+        int slot = (self + 1 + turn) % count;
+        Task *task = tasks->slots[slot];
+        turn++;
+        if (!task->live || task->active)
+            continue;
+        tasks->running = slot;
+        tasks->guard = &guard;
+        vm->catch_frame = &guard;
+        resume(vm, task);
+    }
+    tasks->running = self;
+    tasks->guard = outer;
+    vm->catch_frame = frame;
+}
+
+/* rounds until every task has ended */
+void task_finish(Vm *vm) {
+    while (vm->tasks.live > 0 && vm->tasks.running < 0)
+        task_pause(vm);
+}
+
+/* STOP: ends the running task, past any CATCH in it */
+_Noreturn void task_stop(Vm *vm) {
+    Tasks *tasks = &vm->tasks;
+    if (tasks->running < 0)
+        vm_throw(THROW_UNSUPPORTED, "STOP outside a task\n");
+    tasks->stopping = true;
+    longjmp(tasks->guard->jump, 1);
+}
+
+Cell task_user_area(Vm *vm) {
+    Tasks *tasks = &vm->tasks;
+    if (tasks->running >= 0)
+        return tasks->slots[tasks->running]->user;
+    if (tasks->user == 0)
+        tasks->user = allocate_user(vm->memory.data);
+    return tasks->user;
+}
+
+/* after EXIT or a fault unwound past the rounds: the tasks caught in them cannot resume */
+void task_unwind(Vm *vm) {
+    Tasks *tasks = &vm->tasks;
+    for (int i = 0; i < tasks->count; i++) {
+        if (tasks->slots[i]->active)
+            end_task(tasks, tasks->slots[i]);
+    }
+    tasks->running = -1;
+    tasks->guard = NULL;
+    tasks->stopping = false;
+}
+
+/* all slots and their user areas, which belong to the memory being replaced */
+void task_release(Vm *vm) {
+    Tasks *tasks = &vm->tasks;
+    for (int i = 0; i < tasks->count; i++)
+        free(tasks->slots[i]);
+    free(tasks->slots);
+    tasks->slots = NULL;
+    tasks->count = 0;
+    tasks->live = 0;
+    tasks->running = -1;
+    tasks->user = 0;
+    tasks->guard = NULL;
+    tasks->stopping = false;
+}
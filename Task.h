@@ -0,0 +1,49 @@
+#ifndef TASK_H
+#define TASK_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     Cooperative tasks: each with its own stacks and user area,
+ *                  switched at PAUSE by a round-robin scheduler
+ * License:         MIT
+ */
+
+#include "forth.h"
+#include "Engine.h"
+#include "Profile.h"
+
+/* cells in each USER-AREA */
+#define USER_CELLS  16
+
+typedef struct {
+    Stack stack;
+    Stack return_stack;
+    Resume resume;
+    Instr start[2];             /* the spawned word and a return, where resume starts */
+    Cell user;                  /* cell address of its USER-AREA; kept with the slot */
+    ProfileNode *profile_frame;
+    bool live;
+    bool active;                /* running, or below a PAUSE that is running the others */
+} Task;
+
+struct CatchFrame;
+
+typedef struct {
+    Task **slots;               /* a finished task's slot is reused by the next SPAWN */
+    int count;
+    int live;
+    int running;                /* slot of the task being run, -1 for the interpreter */
+    Cell user;                  /* the interpreter's USER-AREA, 0 until asked for */
+    struct CatchFrame *guard;   /* where a fault or STOP in the running task lands */
+    bool stopping;
+} Tasks;
+
+void task_spawn(Vm *vm, const DictEntry *entry, Cell x);
+void task_pause(Vm *vm);
+void task_finish(Vm *vm);
+_Noreturn void task_stop(Vm *vm);
+Cell task_user_area(Vm *vm);
+void task_unwind(Vm *vm);
+void task_release(Vm *vm);
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     VM context
+ * License:         MIT
+ *
+ * The built-in dictionary and the JIT's code arena are shared; everything a
+ * program can change lives in its Vm. Primitives keep their signatures: the
+ * stacks and memory they are handed already belong to the running VM, and
+ * the few modules that need more reach it through current_vm. A thread runs
+ * one VM at a time; vm_enter() switches, interpret_text() enters its VM.
+ *
+ * Faults unwind with longjmp: vm_throw() lands in the innermost CATCH, or
+ * else in vm_eval(), which reports the fault, empties the stacks and
+ * returns false with the VM and its definitions intact. Nothing is set up
+ * per word, so code that does not fault pays nothing for this.
+ */
+
+#include <stdarg.h>
+#include "Vm.h"
+#include "Image.h"
+
+_Thread_local Vm *current_vm = NULL;
+
+VmConfig vm_defaults(void) {
+    VmConfig config = {
+        .cells = MEMORY_SIZE - SYSTEM_CELLS,
+        .memory_file = NULL,
+        .huge_pages = false,
+        .out = stdout,
+        .shared_out = false,
+        .policy = output_default_policy(),
+        .profile_path = "yafi.folded",
+        .image = NULL,
+    };
+    return config;
+}
+
+/* NULL, with the reason on stderr, when there is no memory for it */
+Vm *vm_create(const VmConfig *config) {
+    Vm *vm = calloc(1, sizeof(Vm));
+    if (!vm) {
+        fprintf(stderr, "Out of memory creating VM\n");
+        return NULL;
+    }
+    init_stack(&vm->stack);
+    init_stack(&vm->return_stack);
+    if (!config->image && !memory_create(&vm->memory, config->cells, config->memory_file, config->huge_pages)) {
+        free(vm);
+        return NULL;
+    }
+    vm->out = config->out;
+    vm->shared_out = config->shared_out;
+    vm->policy = config->policy;
+    vm->profile_path = config->profile_path;
+    vm->tasks.running = -1;
+    vm->status = EXIT_SUCCESS;
+
+    Vm *outer = current_vm;
+    vm_enter(vm);
+    if (config->image)
+        image_load(vm, config->image);
+    else
+        init_memory(vm->memory.data);
+    if (outer)
+        vm_enter(outer);
+    return vm;
+}
+
+/* the output stream is the caller's */
+void vm_destroy(Vm *vm) {
+    if (!vm)
+        return;
+    fflush(vm->out);
+    release_compiler(&vm->compiler);
+    free(vm->xts);
+    profile_destroy(vm->profile);
+    task_release(vm);
+    release_words(&vm->words);
+    memory_destroy(&vm->memory);
+    if (current_vm == vm)
+        current_vm = NULL;
+    free(vm);
+}
+
+void vm_enter(Vm *vm) {
+    current_vm = vm;
+    memory_cells = vm->memory.cells;
+}
+
+static const char *throw_message(int code) {
+    switch (code) {
+        case THROW_STACK_OVERFLOW:      return "Stack overflow!";
+        case THROW_STACK_UNDERFLOW:     return "Stack underflow!";
+        case THROW_RSTACK_OVERFLOW:     return "Return stack overflow!";
+        case THROW_RSTACK_UNDERFLOW:    return "Return stack underflow!";
+        case THROW_DICTIONARY_OVERFLOW: return "Dictionary overflow";
+        case THROW_INVALID_ADDRESS:     return "Invalid memory address";
+        case THROW_DIVISION_BY_ZERO:    return "Division by zero!";
+        case THROW_RESULT_OUT_OF_RANGE: return "Result out of range";
+        case THROW_UNDEFINED_WORD:      return "Undefined word";
+        case THROW_STRING_OVERFLOW:     return "Parsed string overflow";
+        case THROW_UNSUPPORTED:         return "Unsupported operation";
+        case THROW_INVALID_ARGUMENT:    return "Invalid numeric argument";
+        case THROW_FILE_IO:             return "File I/O exception";
+        default:                        return NULL;
+    }
+}
+
+/* the fault's message on stderr, after what the VM has written so far */
+void vm_report(Vm *vm, int code) {
+    const char *message = throw_message(code);
+    fflush(vm->out);
+    if (vm->error[0])
+        fputs(vm->error, stderr);
+    else if (message)
+        fprintf(stderr, "%s\n", message);
+    else
+        fprintf(stderr, "Uncaught THROW %d\n", code);
+}
+
+/* interpret_text(), but a fault or EXIT comes back here instead of ending the process */
+bool vm_eval(Vm *vm, const char *text, size_t length) {
+    jmp_buf recover;
+    jmp_buf *outer = vm->recover;
+    CatchFrame *frame = vm->catch_frame;
+    Lexer *input = vm->input;
+    bool ok;
+
+    vm->recover = &recover;
+    int code = setjmp(recover);
+    if (code == 0) {
+        ok = interpret_text(vm, text, length);
+    } else if (vm->halted) {
+        vm->input = input;
+        task_unwind(vm);
+        ok = (vm->status == EXIT_SUCCESS);
+    } else {
+        vm_report(vm, code);
+        vm->input = input;
+        task_unwind(vm);
+        vm->catch_frame = frame;
+        init_stack(&vm->stack);
+        init_stack(&vm->return_stack);
+        if (vm->profile)
+            profile_unwind(vm->profile, &vm->profile->root);
+        if (is_compiling())
+            compile_abort();
+        ok = false;
+    }
+    vm->recover = outer;
+    return ok;
+}
+
+/* a round of the tasks, or with finish rounds until they have all ended; EXIT in one comes back here */
+bool vm_run_tasks(Vm *vm, bool finish) {
+    jmp_buf recover;
+    jmp_buf *outer = vm->recover;
+    CatchFrame *frame = vm->catch_frame;
+
+    if (vm->halted || vm->tasks.live == 0)
+        return !vm->halted;
+    vm->recover = &recover;
+    if (setjmp(recover) == 0) {
+        if (finish)
+            task_finish(vm);
+        else
+            task_pause(vm);
+    } else {
+        task_unwind(vm);
+        vm->catch_frame = frame;
+    }
+    vm->recover = outer;
+    return !vm->halted;
+}
+
+/* ' hands out small integers: an entry keeps the same one for the VM's life */
+int vm_xt(Vm *vm, const DictEntry *entry) {
+    for (int i = 0; i < vm->xt_count; i++) {
+        if (vm->xts[i] == entry)
+            return i;
+    }
+    if (vm->xt_count == vm->xt_capacity) {
+        int capacity = vm->xt_capacity ? vm->xt_capacity * 2 : 16;
+        const DictEntry **xts = realloc(vm->xts, capacity * sizeof(DictEntry *));
+        if (!xts) {
+            fprintf(stderr, "Out of memory in '\n");
+            exit(EXIT_FAILURE);
+        }
+        vm->xts = xts;
+        vm->xt_capacity = capacity;
+    }
+    vm->xts[vm->xt_count] = entry;
+    return vm->xt_count++;
+}
+
+const DictEntry *vm_xt_entry(Vm *vm, int xt) {
+    if (xt < 0 || xt >= vm->xt_count)
+        vm_throw(THROW_INVALID_ARGUMENT, "Invalid execution token: %d\n", xt);
+    return vm->xts[xt];
+}
+
+/*
+ *  EXIT: ends the running program with a status, past any CATCH. Inside
+ *  vm_eval() control goes back to it; otherwise the process exits.
+ */
+_Noreturn void vm_stop(int status) {
+    Vm *vm = current_vm;
+    if (!vm || !vm->recover)
+        exit(status);
+    vm->halted = true;
+    vm->status = status;
+    longjmp(*vm->recover, 1);
+}
+
+/*
+ *  A fault, or THROW with a non-zero code. The message, when given, is
+ *  only formatted here and only printed if no CATCH takes the code.
+ */
+_Noreturn void vm_throw(int code, const char *format, ...) {
+    Vm *vm = current_vm;
+    va_list args;
+
+    if (!vm) {
+        va_start(args, format);
+        vfprintf(stderr, format, args);
+        va_end(args);
+        exit(EXIT_FAILURE);
+    }
+    vm->error[0] = '\0';
+    if (format) {
+        va_start(args, format);
+        vsnprintf(vm->error, ERROR_SIZE, format, args);
+        va_end(args);
+    }
+    if (vm->catch_frame)
+        longjmp(vm->catch_frame->jump, code);
+    if (vm->recover)
+        longjmp(*vm->recover, code);
+    vm_report(vm, code);
+    exit(EXIT_FAILURE);
+}
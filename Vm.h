@@ -0,0 +1,99 @@
+#ifndef VM_H
+#define VM_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     VM context: the stacks, memory, dictionary overlay,
+ *                  compiler state and output of one interpreter, so that
+ *                  several can run side by side, one per thread
+ * License:         MIT
+ */
+
+#include <setjmp.h>
+#include "forth.h"
+#include "Memory.h"
+#include "Dictionary.h"
+#include "Compiler.h"
+#include "Lexer.h"
+#include "Output.h"
+#include "Peephole.h"
+#include "Profile.h"
+#include "Task.h"
+
+/* THROW codes for the VM's own faults, numbered as in Forth-94 */
+#define THROW_STACK_OVERFLOW        (-3)
+#define THROW_STACK_UNDERFLOW       (-4)
+#define THROW_RSTACK_OVERFLOW       (-5)
+#define THROW_RSTACK_UNDERFLOW      (-6)
+#define THROW_DICTIONARY_OVERFLOW   (-8)
+#define THROW_INVALID_ADDRESS       (-9)
+#define THROW_DIVISION_BY_ZERO      (-10)
+#define THROW_RESULT_OUT_OF_RANGE   (-11)
+#define THROW_UNDEFINED_WORD        (-13)
+#define THROW_STRING_OVERFLOW       (-18)
+#define THROW_UNSUPPORTED           (-21)
+#define THROW_INVALID_ARGUMENT      (-24)
+#define THROW_FILE_IO               (-37)
+
+#define ERROR_SIZE  160
+
+/* one CATCH in progress: where THROW lands and the depths it restores */
+typedef struct CatchFrame {
+    jmp_buf jump;
+    int depth;
+    int return_depth;
+    ProfileNode *profile_frame;
+    struct CatchFrame *outer;
+} CatchFrame;
+
+typedef struct {
+    size_t cells;               /* user cells; SYSTEM_CELLS come on top */
+    const char *memory_file;
+    bool huge_pages;
+    FILE *out;
+    bool shared_out;            /* other threads may write to out as well */
+    FlushPolicy policy;
+    const char *profile_path;   /* where PROFILE-DUMP writes */
+    const char *image;          /* start from this SAVE-IMAGE file instead of empty memory */
+} VmConfig;
+
+struct Vm {
+    Stack stack;
+    Stack return_stack;
+    Memory memory;
+    WordTable words;
+    CompilerState compiler;
+    Lexer *input;               /* the text being interpreted, so : can take its name from it */
+    FILE *out;
+    bool shared_out;
+    FlushPolicy policy;
+    unsigned long fusions[FUSION_COUNT];
+    const DictEntry **xts;      /* execution tokens handed out by ' */
+    int xt_count;
+    int xt_capacity;
+    CatchFrame *catch_frame;    /* innermost CATCH, NULL outside any */
+    jmp_buf *recover;           /* vm_eval() in progress; NULL exits the process */
+    char error[ERROR_SIZE];     /* the last fault, reported if nothing catches it */
+    Profile *profile;           /* created by PROFILE-ON */
+    const char *profile_path;
+    Tasks tasks;                /* SPAWNed, run at PAUSE */
+    bool halted;
+    int status;
+};
+
+/* the VM running on this thread, set by vm_enter() */
+extern _Thread_local Vm *current_vm;
+
+VmConfig vm_defaults(void);
+Vm *vm_create(const VmConfig *config);
+void vm_destroy(Vm *vm);
+void vm_enter(Vm *vm);
+bool vm_eval(Vm *vm, const char *text, size_t length);
+bool vm_run_tasks(Vm *vm, bool finish);
+void vm_report(Vm *vm, int code);
+int vm_xt(Vm *vm, const DictEntry *entry);
+const DictEntry *vm_xt_entry(Vm *vm, int xt);
+_Noreturn void vm_stop(int status);
+_Noreturn void vm_throw(int code, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif
@@ -0,0 +1,377 @@
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     yafi-aot: translates a Forth source file into a C
+ *                  translation unit that links against the op_* primitives
+ * License:         MIT
+ *
+ *   yafi-aot program.fth program.c
+ *   gcc -O2 -I. program.c forth.o ... Stack.o -o program     (see 'make aot')
+ *
+ * The source is compiled by the normal compiler, with top-level code recorded
+ * instead of run. Every reachable definition becomes a C function; simple
+ * primitives become inline C over the data stack, the rest call op_*.
+ * Literals are converted at translation time: DECIMAL, HEX and BINARY at
+ * top level take effect then, a computed 'n BASE !' only at run time.
+ */
+
+#include "forth.h"
+#include "Dictionary.h"
+#include "Compiler.h"
+#include "Source.h"
+#include "Vm.h"
+
+/* inline C for each opcode; the one conversion in a snippet takes the instruction's operand */
+static const char *snippets[OPCODE_COUNT] = {
+    [OPC_LIT]           = "push_(%" PRIdCELL ");",
+
+    /* COMPUTATION */
+    [OPC_LESS_THAN]     = "BINARY_((a < b) ? -1 : 0);",
+    [OPC_EQUAL]         = "BINARY_((a == b) ? -1 : 0);",
+    [OPC_GREATER_THAN]  = "BINARY_((a > b) ? -1 : 0);",
+    [OPC_ZERO_LESS]     = "UNARY_((a < 0) ? -1 : 0);",
+    [OPC_ZERO_EQUAL]    = "UNARY_((a == 0) ? -1 : 0);",
+    [OPC_ZERO_GREATER]  = "UNARY_((a > 0) ? -1 : 0);",
+    [OPC_D_LESS]        = "op_d_less(&stack);",
+    [OPC_NOT]           = "UNARY_(~a);",
+
+    /* IO-CHARACTERS */
+    [OPC_CR]            = "op_cr();",
+    [OPC_EMIT]          = "op_emit(&stack);",
+    [OPC_SPACE]         = "op_space();",
+    [OPC_SPACES]        = "op_spaces(&stack);",
+    [OPC_TYPE]          = "op_type(&stack, (uint8_t *)memory);",
+    [OPC_COUNT]         = "op_count(&stack, (uint8_t *)memory);",
+
+    /* LOGICAL */
+    [OPC_ADD]           = "BINARY_(a + b);",
+    [OPC_SUB]           = "BINARY_(a - b);",
+    [OPC_MUL]           = "BINARY_(a * b);",
+    [OPC_DIV]           = "DIVIDE_(a / b, \"Division by zero!\");",
+    [OPC_MOD]           = "DIVIDE_(a %% b, \"Modulo by zero!\");",
+    [OPC_DIVMOD]        = "DIVMOD_();",
+    [OPC_ONE_PLUS]      = "UNARY_(a + 1);",
+    [OPC_ONE_MINUS]     = "UNARY_(a - 1);",
+    [OPC_TWO_PLUS]      = "UNARY_(a + 2);",
+    [OPC_TWO_MINUS]     = "UNARY_(a - 2);",
+    [OPC_D_PLUS]        = "op_d_plus(&stack);",
+    [OPC_MAX]           = "BINARY_((a > b) ? a : b);",
+    [OPC_MIN]           = "BINARY_((a < b) ? a : b);",
+    [OPC_ABS]           = "UNARY_((a < 0) ? -a : a);",
+    [OPC_NEGATE]        = "UNARY_(-a);",
+    [OPC_DNEGATE]       = "op_dnegate(&stack);",
+    [OPC_AND]           = "BINARY_(a & b);",
+    [OPC_OR]            = "BINARY_(a | b);",
+    [OPC_XOR]           = "BINARY_(a ^ b);",
+    [OPC_M_STAR]        = "op_m_star(&stack);",
+    [OPC_UM_STAR]       = "op_um_star(&stack);",
+    [OPC_UM_SLASH_MOD]  = "op_um_slash_mod(&stack);",
+    [OPC_STAR_SLASH]    = "op_star_slash(&stack);",
+    [OPC_STAR_SLASH_MOD] = "op_star_slash_mod(&stack);",
+
+    /* MEMORY */
+    [OPC_FETCH]         = "{ Cell addr = cell_(pop_(), \"at @\"); push_(memory[addr]); }",
+    [OPC_STORE]         = "{ Cell addr = cell_(pop_(), \"at !\"); memory[addr] = pop_(); }",
+    [OPC_CFETCH]        = "{ Cell addr = byte_(pop_(), \"in C@\"); push_(((uint8_t *)memory)[addr]); }",
+    [OPC_CSTORE]        = "{ Cell addr = byte_(pop_(), \"in C!\"); ((uint8_t *)memory)[addr] = (uint8_t)pop_(); }",
+    [OPC_QUESTION]      = "op_question(&stack, memory);",
+    [OPC_MOVE]          = "op_move(&stack, (uint8_t *)memory);",
+    [OPC_CMOVE]         = "op_cmove(&stack, (uint8_t *)memory);",
+    [OPC_FILL]          = "op_fill(&stack, (uint8_t *)memory);",
+    [OPC_CELLS_SUM]     = "op_cells_sum(&stack, memory);",
+    [OPC_CELLS_MIN]     = "op_cells_min(&stack, memory);",
+    [OPC_CELLS_MAX]     = "op_cells_max(&stack, memory);",
+    [OPC_CELLS_COMPARE] = "op_cells_compare(&stack, memory);",
+    [OPC_CELLS_SEARCH]  = "op_cells_search(&stack, memory);",
+
+    /* STACK */
+    [OPC_DUP]           = "{ Cell a = pop_(); push_(a); push_(a); }",
+    [OPC_DROP]          = "(void)pop_();",
+    [OPC_SWAP]          = "{ Cell b = pop_(); Cell a = pop_(); push_(b); push_(a); }",
+    [OPC_OVER]          = "{ Cell b = pop_(); Cell a = pop_(); push_(a); push_(b); push_(a); }",
+    [OPC_ROT]           = "{ Cell c = pop_(); Cell b = pop_(); Cell a = pop_(); push_(b); push_(c); push_(a); }",
+    [OPC_PICK]          = "op_pick(&stack);",
+    [OPC_ROLL]          = "op_roll(&stack);",
+    [OPC_DEPTH]         = "push_(stack.top);",
+    [OPC_TO_R]          = "op_to_r(&stack, &return_stack);",
+    [OPC_R_FROM]        = "op_r_from(&stack, &return_stack);",
+    [OPC_R_FETCH]       = "op_r_fetch(&stack, &return_stack);",
+
+    /* IO-NUMBERS */
+    [OPC_PRINT]         = "op_print(&stack, memory);",
+    [OPC_D_PRINT]       = "op_d_print(&stack, memory);",
+    [OPC_BASE]          = "push_(BASE_CELL);",
+    [OPC_DECIMAL]       = "memory[BASE_CELL] = 10;",
+    [OPC_HEX]           = "memory[BASE_CELL] = 16;",
+    [OPC_BINARY]        = "memory[BASE_CELL] = 2;",
+
+    /* EXECUTION: no execution tokens at run time, so only THROW */
+    [OPC_THROW]         = "op_throw(&stack);",
+
+    /* TOOLS, PSEUDO */
+    [OPC_FUSIONS]       = "op_fusions();",
+    [OPC_FLUSH]         = "op_flush();",
+    [OPC_PROFILE_ON]    = "op_profile_on();",
+    [OPC_PROFILE_OFF]   = "op_profile_off();",
+    [OPC_PROFILE_DUMP]  = "op_profile_dump();",
+    [OPC_EXIT]          = "op_exit();",
+
+    /* SUPERINSTRUCTIONS */
+    [OPC_DUP_ADD]       = "UNARY_(a + a);",
+    [OPC_NIP]           = "{ Cell b = pop_(); (void)pop_(); push_(b); }",
+    [OPC_TWO_DUP]       = "{ Cell b = pop_(); Cell a = pop_(); push_(a); push_(b); push_(a); push_(b); }",
+    [OPC_LIT_ADD]       = "UNARY_(a + %" PRIdCELL ");",
+    [OPC_LIT_FETCH]     = "push_(memory[%" PRIdCELL "]);",
+    [OPC_LIT_STORE]     = "memory[%" PRIdCELL "] = pop_();",
+};
+
+static const char *prelude =
+    "#include \"forth.h\"\n"
+    "#include \"Output.h\"\n"
+    "#include \"Vm.h\"\n"
+    "\n"
+    "static Vm *vm_;\n"
+    "static Cell *memory;\n"
+    "#define stack           (vm_->stack)\n"
+    "#define return_stack    (vm_->return_stack)\n"
+    "\n"
+    "static void fault_(const char *message) {\n"
+    "    fprintf(stderr, \"%s\\n\", message);\n"
+    "    exit(EXIT_FAILURE);\n"
+    "}\n"
+    "\n"
+    "static inline void push_(Cell value) {\n"
+    "    if (stack.top >= STACK_SIZE)\n"
+    "        fault_(\"Stack overflow!\");\n"
+    "    stack.data[stack.top++] = value;\n"
+    "}\n"
+    "\n"
+    "static inline Cell pop_(void) {\n"
+    "    if (stack.top == 0)\n"
+    "        fault_(\"Stack underflow!\");\n"
+    "    return stack.data[--stack.top];\n"
+    "}\n"
+    "\n"
+    "static inline Cell cell_(Cell addr, const char *where) {\n"
+    "    if ((UCell)addr >= (UCell)memory_cells) {\n"
+    "        fprintf(stderr, \"Memory access out of bounds %s\\n\", where);\n"
+    "        exit(EXIT_FAILURE);\n"
+    "    }\n"
+    "    return addr;\n"
+    "}\n"
+    "\n"
+    "static inline Cell byte_(Cell addr, const char *where) {\n"
+    "    if ((UCell)addr >= (size_t)memory_cells * sizeof(Cell)) {\n"
+    "        fprintf(stderr, \"Memory access out of bounds %s\\n\", where);\n"
+    "        exit(EXIT_FAILURE);\n"
+    "    }\n"
+    "    return addr;\n"
+    "}\n"
+    "\n"
+    "#define UNARY_(e)        do { Cell a = pop_(); push_(e); } while (0)\n"
+    "#define BINARY_(e)       do { Cell b = pop_(); Cell a = pop_(); push_(e); } while (0)\n"
+    "#define DIVIDE_(e, msg)  do { Cell b = pop_(); Cell a = pop_(); if (b == 0) fault_(msg); \\\n"
+    "                              if (a == CELL_MIN && b == -1) fault_(\"Result out of range\"); push_(e); } while (0)\n"
+    "#define DIVMOD_()        do { Cell b = pop_(); Cell a = pop_(); \\\n"
+    "                              if (b == 0) fault_(\"/MOD error: Division by zero\"); \\\n"
+    "                              if (a == CELL_MIN && b == -1) fault_(\"/MOD error: Result out of range\"); \\\n"
+    "                              push_(a % b); push_(a / b); } while (0)\n"
+    "\n";
+
+static const DictEntry **words = NULL;
+static int word_count = 0;
+
+static int word_index(const DictEntry *entry) {
+    for (int i = 0; i < word_count; i++) {
+        if (words[i] == entry)
+            return i;
+    }
+    return -1;
+}
+
+/* every definition reachable from body, callees first seen first */
+static void collect(const Definition *colon) {
+    for (int i = 0; i < colon->length; i++) {
+        const DictEntry *callee = colon->body[i].entry;
+        if (colon->body[i].op != OPC_CALL || word_index(callee) >= 0)
+            continue;
+        words = realloc(words, (word_count + 1) * sizeof(DictEntry *));
+        if (!words) {
+            fprintf(stderr, "Out of memory in yafi-aot\n");
+            exit(EXIT_FAILURE);
+        }
+        words[word_count++] = callee;
+        collect(callee->func.colon);
+    }
+}
+
+static bool is_branch(Opcode op) {
+    return op == OPC_BRANCH || op == OPC_ZERO_BRANCH || op == OPC_TRUE_BRANCH
+        || op == OPC_LOOP || op == OPC_PLUS_LOOP;
+}
+
+/*
+ *  Branches become gotos and each DO loop gets its own pair of locals. Loops
+ *  nest in the order they appear in the body, so depth is the number of
+ *  loops open at an instruction; (UNLOOP) has nothing to do, the locals end
+ *  with the function.
+ */
+static void emit_control(FILE *out, const Instr *instr, int target, int *depth) {
+    int d = *depth - 1;
+    switch (instr->op) {
+        case OPC_BRANCH:        fprintf(out, "goto l_%d;", target); break;
+        case OPC_ZERO_BRANCH:   fprintf(out, "if (pop_() == 0) goto l_%d;", target); break;
+        case OPC_TRUE_BRANCH:   fprintf(out, "if (pop_() != 0) goto l_%d;", target); break;
+        case OPC_DO:
+            fprintf(out, "{ Cell i = pop_(); limit_[%d] = pop_(); index_[%d] = i; }", d + 1, d + 1);
+            (*depth)++;
+            break;
+        case OPC_LOOP:
+            fprintf(out, "if (++index_[%d] < limit_[%d]) goto l_%d;", d, d, target);
+            (*depth)--;
+            break;
+        case OPC_PLUS_LOOP:
+            fprintf(out, "{ Cell n = pop_(); index_[%d] += n; "
+                         "if ((n < 0) ? (index_[%d] >= limit_[%d]) : (index_[%d] < limit_[%d])) goto l_%d; }",
+                    d, d, d, d, d, target);
+            (*depth)--;
+            break;
+        case OPC_I:             fprintf(out, "push_(index_[%d]);", d); break;
+        case OPC_J:             fprintf(out, "push_(index_[%d]);", d - 1); break;
+        case OPC_LEAVE:         fprintf(out, "limit_[%d] = index_[%d];", d, d); break;
+        default:                fprintf(out, ";"); break;
+    }
+}
+
+static bool emit_body(FILE *out, const Definition *colon, bool is_main) {
+    bool *targets = calloc(colon->length, sizeof(bool));
+    int depth = 0;
+    int loops = 0;
+    if (!targets) {
+        fprintf(stderr, "Out of memory in yafi-aot\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < colon->length; i++) {
+        const Instr *instr = &colon->body[i];
+        if (is_branch(instr->op))
+            targets[i + 1 + instr->value] = true;
+        if (instr->op == OPC_DO && ++depth > loops)
+            loops = depth;
+        if (instr->op == OPC_LOOP || instr->op == OPC_PLUS_LOOP)
+            depth--;
+    }
+    if (loops > 0)
+        fprintf(out, "    Cell index_[%d], limit_[%d];\n", loops, loops);
+
+    for (int i = 0; i < colon->length; i++) {
+        const Instr *instr = &colon->body[i];
+        if (targets[i])
+            fprintf(out, "l_%d:\n", i);
+        if (instr->op == OPC_RET && i == colon->length - 1) {
+            if (targets[i])
+                fprintf(out, "    ;\n");
+            break;
+        }
+
+        fprintf(out, "    ");
+        if (instr->op == OPC_RET) {
+            fprintf(out, "%s", is_main ? "return EXIT_SUCCESS;" : "return;");
+        } else if (instr->op == OPC_CALL) {
+            fprintf(out, "w_%d();", word_index(instr->entry));
+        } else if (instr->entry->type == OP_CONTROL) {
+            emit_control(out, instr, i + 1 + (int)instr->value, &depth);
+        } else if (snippets[instr->op]) {
+            fprintf(out, snippets[instr->op], instr->value);
+        } else {
+            fprintf(stderr, "yafi-aot: cannot translate %s\n", instr->entry->word);
+            free(targets);
+            return false;
+        }
+        fprintf(out, "%*s/* %s */\n", 4, "", instr->entry->word);
+    }
+    free(targets);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    VmConfig config = vm_defaults();
+    Source source;
+    const char *line;
+    size_t length;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s program.fth program.c\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (!source_open(&source, argv[1]))
+        return EXIT_FAILURE;
+
+    init_dictionary();
+    Vm *vm = vm_create(&config);
+    if (!vm)
+        return EXIT_FAILURE;
+    vm_enter(vm);
+    Cell strings_top = vm->memory.data[STRINGS_CELL];
+
+    record_begin();
+    bool ok = true;
+    while (ok && source_next_line(&source, &line, &length))
+        ok = interpret_text(vm, line, length);
+    if (!source_close(&source) || !ok)
+        return EXIT_FAILURE;
+    if (is_compiling()) {
+        fprintf(stderr, "yafi-aot: %s ends inside a definition\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    Definition *program = record_end();
+    collect(program);
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+    fprintf(out, "/* generated by yafi-aot from %s */\n", argv[1]);
+    fprintf(out, "%s", prelude);
+
+    /* the string literals, packed below the system cells as the compiler left them */
+    Cell strings = strings_bottom(vm->memory.data);
+    if (strings < strings_top) {
+        const uint8_t *bytes = (const uint8_t *)vm->memory.data;
+        fprintf(out, "static const uint8_t strings_[] = {");
+        for (Cell at = strings; at < strings_top; at++)
+            fprintf(out, "%s%s%u", (at > strings) ? "," : "", ((at - strings) % 16) ? " " : "\n    ", bytes[at]);
+        fprintf(out, "\n};\n\n");
+    }
+    for (int i = 0; i < word_count; i++)
+        fprintf(out, "static void w_%d(void);%*s/* %s */\n", i, 4, "", words[i]->word);
+
+    for (int i = 0; i < word_count && ok; i++) {
+        fprintf(out, "\n/* : %s */\nstatic void w_%d(void) {\n", words[i]->word, i);
+        ok = emit_body(out, words[i]->func.colon, false);
+        fprintf(out, "}\n");
+    }
+    if (ok) {
+        fprintf(out, "\nint main(void) {\n");
+        fprintf(out, "    VmConfig config = vm_defaults();\n");
+        fprintf(out, "    output_init();\n");
+        fprintf(out, "    vm_ = vm_create(&config);\n");
+        fprintf(out, "    if (!vm_)\n        return EXIT_FAILURE;\n");
+        fprintf(out, "    vm_enter(vm_);\n");
+        fprintf(out, "    memory = vm_->memory.data;\n");
+        if (strings < strings_top) {
+            fprintf(out, "    memcpy((uint8_t *)memory + %" PRIdCELL ", strings_, sizeof(strings_));\n", strings);
+            fprintf(out, "    memory[STRINGS_CELL] = %" PRIdCELL ";\n", strings);
+        }
+        ok = emit_body(out, program, true);
+        fprintf(out, "    fflush(stdout);\n");
+        fprintf(out, "    return EXIT_SUCCESS;\n");
+        fprintf(out, "}\n");
+    }
+    fclose(out);
+
+    if (!ok) {
+        remove(argv[2]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
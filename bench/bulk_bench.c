@@ -0,0 +1,111 @@
+/*
+ * Microbenchmark: bulk memory throughput in GB/sec. Byte copy and fill
+ * against a byte-at-a-time loop, and each cell-array kernel at every
+ * SIMD level the CPU supports. The levels are cross-checked first.
+ *
+ *   make bench-bulk
+ */
+
+#include <time.h>
+#include "../Bulk.h"
+#include "../forth.h"
+
+#define CELLS       (16 * 1024 * 1024)
+#define ROUNDS      10
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double gbps(size_t bytes, double seconds) {
+    return bytes * (double)ROUNDS / seconds / 1e9;
+}
+
+static void byte_copy(uint8_t *dest, const uint8_t *src, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        ((volatile uint8_t *)dest)[i] = src[i];
+}
+
+/* every level must agree with the scalar kernels on awkward lengths */
+static bool cross_check(const Cell *a, const Cell *b) {
+    const BulkKernels *reference = bulk_kernels(BULK_SCALAR);
+    for (int level = BULK_SSE2; level < BULK_LEVELS; level++) {
+        const BulkKernels *k = bulk_kernels((BulkLevel)level);
+        if (!k)
+            continue;
+        for (size_t n = 1; n < 100; n++) {
+            if (k->sum(a, n) != reference->sum(a, n) || k->min(a, n) != reference->min(a, n)
+                    || k->max(a, n) != reference->max(a, n)
+                    || k->search(a, n, a[n - 1]) != reference->search(a, n, a[n - 1])
+                    || k->search(a, n, 12345) != reference->search(a, n, 12345)
+                    || k->mismatch(a, b, n) != reference->mismatch(a, b, n)) {
+                fprintf(stderr, "%s disagrees with scalar at n = %zu\n", k->name, n);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(void) {
+    Cell *a = malloc(CELLS * sizeof(Cell));
+    Cell *b = malloc(CELLS * sizeof(Cell));
+    if (!a || !b) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < CELLS; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        a[i] = (Cell)(x % 2000000) - 1000000;
+        b[i] = a[i];
+    }
+    b[CELLS - 1] ^= 1;
+    if (!cross_check(a, b))
+        return EXIT_FAILURE;
+
+    size_t bytes = CELLS * sizeof(Cell);
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++)
+        byte_copy((uint8_t *)b, (const uint8_t *)a, bytes);
+    fprintf(stdout, "%-8s %-14s %6.2f GB/sec\n", "bytes", "copy", gbps(bytes, now() - start));
+    start = now();
+    for (int r = 0; r < ROUNDS; r++)
+        bulk_copy((uint8_t *)b, (const uint8_t *)a, bytes);
+    fprintf(stdout, "%-8s %-14s %6.2f GB/sec\n", "bulk", "MOVE", gbps(bytes, now() - start));
+    start = now();
+    for (int r = 0; r < ROUNDS; r++)
+        bulk_fill((uint8_t *)b, r, bytes);
+    fprintf(stdout, "%-8s %-14s %6.2f GB/sec\n", "bulk", "FILL", gbps(bytes, now() - start));
+    memcpy(b, a, bytes);
+    b[CELLS - 1] ^= 1;
+
+    long sink = 0;
+    for (int level = BULK_SCALAR; level < BULK_LEVELS; level++) {
+        const BulkKernels *k = bulk_kernels((BulkLevel)level);
+        if (!k)
+            continue;
+        start = now();
+        for (int r = 0; r < ROUNDS; r++)
+            sink += k->sum(a, CELLS);
+        fprintf(stdout, "%-8s %-14s %6.2f GB/sec\n", k->name, CSUM, gbps(bytes, now() - start));
+        start = now();
+        for (int r = 0; r < ROUNDS; r++)
+            sink += k->min(a, CELLS) + k->max(a, CELLS);
+        fprintf(stdout, "%-8s %-14s %6.2f GB/sec\n", k->name, "MIN+MAX", gbps(2 * bytes, now() - start));
+        start = now();
+        for (int r = 0; r < ROUNDS; r++)
+            sink += (long)k->search(a, CELLS, 1000001);
+        fprintf(stdout, "%-8s %-14s %6.2f GB/sec\n", k->name, CFIND, gbps(bytes, now() - start));
+        start = now();
+        for (int r = 0; r < ROUNDS; r++)
+            sink += (long)k->mismatch(a, b, CELLS);
+        fprintf(stdout, "%-8s %-14s %6.2f GB/sec\n", k->name, CCMP, gbps(2 * bytes, now() - start));
+    }
+    fprintf(stdout, "(checksum %ld)\n", sink);
+    free(a);
+    free(b);
+    return EXIT_SUCCESS;
+}
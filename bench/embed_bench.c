@@ -0,0 +1,80 @@
+/*
+ * Microbenchmark: latency of one small evaluation through libyafi, against
+ * piping the same text to a new Forth process. The embedded case also runs
+ * a host-defined word and reads the result back from the stack.
+ *
+ *   make bench-embed
+ */
+
+#include <time.h>
+#include "../yafi.h"
+
+#define EVALS       100000
+#define SPAWNS      200
+#define PROGRAM     "7 6 * TICKS + "
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int ticks = 0;
+
+static void op_ticks(Stack *s) {
+    push(s, ticks++);
+}
+
+static double embedded(long *sum) {
+    Vm *vm = yafi_create(0, NULL);
+    DictEntry word = { "TICKS", OP_0, {.fp_s = op_ticks}, OPC_NATIVE, 0, 1 };
+    long total = 0;
+    Cell value;
+
+    if (!yafi_define(vm, &word))
+        return 0;
+    double start = now();
+    for (int i = 0; i < EVALS; i++) {
+        if (!yafi_eval(vm, PROGRAM, sizeof(PROGRAM) - 1) || !yafi_pop(vm, &value))
+            return 0;
+        total += value;
+    }
+    double elapsed = now() - start;
+    yafi_destroy(vm);
+    *sum = total;
+    return elapsed / EVALS;
+}
+
+/* TICKS is not there, so the process runs '7 6 * .' instead */
+static double spawned(const char *forth) {
+    char command[256];
+    char result[64];
+
+    snprintf(command, sizeof(command), "echo '7 6 * .' | %s", forth);
+    double start = now();
+    for (int i = 0; i < SPAWNS; i++) {
+        FILE *pipe = popen(command, "r");
+        if (!pipe || !fgets(result, sizeof(result), pipe))
+            return 0;
+        pclose(pipe);
+    }
+    return (now() - start) / SPAWNS;
+}
+
+int main(int argc, char *argv[]) {
+    long sum = 0;
+    double in_process = embedded(&sum);
+    if (in_process == 0 || sum != 42L * EVALS + (long)EVALS * (EVALS - 1) / 2) {
+        fprintf(stderr, "embedded evaluation failed (sum %ld)\n", sum);
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "yafi_eval   : %10.2f us/eval\n", in_process * 1e6);
+
+    double process = spawned(argc > 1 ? argv[1] : "./Forth");
+    if (process == 0) {
+        fprintf(stderr, "cannot run %s\n", argc > 1 ? argv[1] : "./Forth");
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "spawn Forth : %10.2f us/eval (%.0fx)\n", process * 1e6, process / in_process);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,508 @@
+/*
+ * Benchmark suite: classic Forth workloads run through libyafi, each in a
+ * fresh VM with output going to /dev/null. Every workload is timed RUNS
+ * times; the median gives ns per executed Forth word and words/sec, and
+ * all samples are written as JSON for comparing builds.
+ *
+ *   make bench [RUNS=N]
+ *   bench/forth_bench [-n RUNS] [--no-jit] [results.json]
+ *
+ * A word is a word of the source as written, literals included, so the
+ * numbers do not move when the peephole pass fuses instructions. The
+ * first workloads are generated unrolled, the way scripts were written
+ * before DO ... LOOP; fib recurses through EXECUTE on a computed token.
+ * The -script workloads run that unrolled source at top level, as such
+ * scripts did, and the -loop workloads do the same work with loops; time
+ * per run compares the three. task-switch measures PAUSE: every switch
+ * into a task and back out of it counts once, reported per second too.
+ * image-round-trip saves and loads through two image files, and fails if
+ * a word defined before the first LOAD-IMAGE comes back with a later one.
+ */
+
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include "../yafi.h"
+#include "../Jit.h"
+
+#define RUNS        11
+#define MAX_RUNS    1001
+
+typedef struct {
+    FILE *src;
+    long body;          /* words in the definition being written */
+    bool script;        /* write definitions' bodies at top level instead */
+} Gen;
+
+typedef struct {
+    const char *name;
+    const char *run;    /* evaluated once per sample, leaves a check value; NULL runs the whole source */
+    long words;         /* words one evaluation of run executes */
+    long switches;      /* task switches it makes, if it is about tasks */
+    int expected;
+} Workload;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* writes source text, counting its words towards the open definition */
+static void code(Gen *g, const char *format, ...) {
+    char text[256];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    fprintf(g->src, "%s ", text);
+
+    for (const char *p = text; *p; ) {
+        while (*p == ' ')
+            p++;
+        if (*p)
+            g->body++;
+        while (*p && *p != ' ')
+            p++;
+    }
+}
+
+static void define(Gen *g, const char *name) {
+    if (!g->script)
+        fprintf(g->src, ": %s ", name);
+    g->body = 0;
+}
+
+static long end(Gen *g) {
+    fprintf(g->src, g->script ? "\n" : ";\n");
+    return g->body;
+}
+
+/*
+ *  WORKLOADS
+ */
+
+#define FIB_N       22
+#define FIB_XT      1000
+
+static long fib_words(int n) {
+    /* FIB: 12 words, FIB-REC: 11 more and two recursive calls */
+    return 12 + ((n < 2) ? 0 : 11 + fib_words(n - 1) + fib_words(n - 2));
+}
+
+static int fib_value(int n) {
+    return (n < 2) ? n : fib_value(n - 1) + fib_value(n - 2);
+}
+
+/* FIB EXECUTEs FIB-BASE or FIB-REC: the flag masks one of the two tokens */
+static void fib(Gen *g, Workload *w) {
+    fprintf(g->src, ": FIB-BASE ;\n");
+    fprintf(g->src, ": FIB-REC DUP 1- %d @ EXECUTE SWAP 2 - %d @ EXECUTE + ;\n", FIB_XT, FIB_XT);
+    fprintf(g->src, ": FIB DUP 2 < DUP ' FIB-BASE AND SWAP NOT ' FIB-REC AND OR EXECUTE ;\n");
+    fprintf(g->src, "' FIB %d !\n", FIB_XT);
+    w->run = "22 FIB";
+    w->words = 2 + fib_words(FIB_N);
+    w->expected = fib_value(FIB_N);
+}
+
+#define SIEVE_BASE  1024
+#define SIEVE_N     8192
+
+/* the composites below N, which end up marked */
+static int sieve_marks(void) {
+    int marked = 0;
+    for (int j = 4; j < SIEVE_N; j++) {
+        for (int i = 2; i * i <= j; i++) {
+            if (j % i == 0) {
+                marked++;
+                break;
+            }
+        }
+    }
+    return marked;
+}
+
+/* marks every multiple of every i up to sqrt(N), prime or not, and counts the marks */
+static void sieve(Gen *g, Workload *w) {
+    define(g, "SIEVE");
+    code(g, "%d %d 0 FILL", SIEVE_BASE * (int)sizeof(Cell), SIEVE_N * (int)sizeof(Cell));
+    for (int i = 2; i * i < SIEVE_N; i++) {
+        for (int j = i * i; j < SIEVE_N; j += i)
+            code(g, "1 %d !", SIEVE_BASE + j);
+    }
+    code(g, "%d %d CELLS-SUM", SIEVE_BASE, SIEVE_N);
+    w->words = end(g);
+    w->run = "SIEVE";
+    w->expected = sieve_marks();
+}
+
+#define SORT_BASE   1024
+#define SORT_N      64
+
+/* refills the array in descending order, then one compare-exchange per step of bubble sort */
+static void bubble(Gen *g, Workload *w) {
+    define(g, "BUBBLE");
+    for (int i = 0; i < SORT_N; i++)
+        code(g, "%d %d !", SORT_N - i, SORT_BASE + i);
+    for (int pass = SORT_N - 1; pass > 0; pass--) {
+        for (int i = 0; i < pass; i++) {
+            int a = SORT_BASE + i;
+            code(g, "%d @ %d @ OVER OVER MAX %d ! MIN %d !", a, a + 1, a + 1, a);
+        }
+    }
+    code(g, "%d @ 1000 * %d @ +", SORT_BASE, SORT_BASE + SORT_N - 1);
+    w->words = end(g);
+    w->run = "BUBBLE";
+    w->expected = 1 * 1000 + SORT_N;
+}
+
+#define MAT_A       1024
+#define MAT_B       2048
+#define MAT_C       3072
+#define MAT_N       12
+
+/* stores A and B; returns the sum of the cells of A * B */
+static int matrix_setup(Gen *g) {
+    long sum = 0;
+
+    for (int i = 0; i < MAT_N; i++) {
+        for (int j = 0; j < MAT_N; j++)
+            fprintf(g->src, "%d %d ! %d %d !\n", i + j, MAT_A + i * MAT_N + j, i - j, MAT_B + i * MAT_N + j);
+    }
+    for (int i = 0; i < MAT_N; i++) {
+        for (int j = 0; j < MAT_N; j++) {
+            for (int k = 0; k < MAT_N; k++)
+                sum += (i + k) * (k - j);
+        }
+    }
+    return (int)sum;
+}
+
+static void matrix(Gen *g, Workload *w) {
+    int sum = matrix_setup(g);
+
+    define(g, "MATMUL");
+    for (int i = 0; i < MAT_N; i++) {
+        for (int j = 0; j < MAT_N; j++) {
+            for (int k = 0; k < MAT_N; k++) {
+                code(g, "%d @ %d @ *", MAT_A + i * MAT_N + k, MAT_B + k * MAT_N + j);
+                if (k > 0)
+                    code(g, "+");
+            }
+            code(g, "%d !", MAT_C + i * MAT_N + j);
+        }
+    }
+    code(g, "%d %d CELLS-SUM", MAT_C, MAT_N * MAT_N);
+    w->words = end(g);
+    w->run = "MATMUL";
+    w->expected = sum;
+}
+
+#define COPY_BYTES  16384
+#define COPY_SRC    0
+#define COPY_DEST   32768
+#define COPIES      64
+
+/* MOVE ( src dest n ), CMOVE ( dest src n ): copies the block there and back */
+static void copy(Gen *g, Workload *w) {
+    fprintf(g->src, "4242 %d !\n", COPY_SRC / (int)sizeof(Cell));
+
+    define(g, "COPY");
+    for (int i = 0; i < COPIES / 2; i++) {
+        code(g, "%d %d %d MOVE", COPY_SRC, COPY_DEST, COPY_BYTES);
+        code(g, "%d %d %d CMOVE", COPY_SRC, COPY_DEST, COPY_BYTES);
+    }
+    code(g, "%d @", COPY_DEST / (int)sizeof(Cell));
+    w->words = end(g);
+    w->run = "COPY";
+    w->expected = 4242;
+}
+
+#define LINES       256
+#define LINE        64
+
+static void output(Gen *g, Workload *w) {
+    for (int i = 0; i < LINE; i++)
+        fprintf(g->src, "%d %d !\n", 'a' + i % 26, i);
+
+    define(g, "LINE-EMIT");
+    for (int i = 0; i < LINE; i++)
+        code(g, "%d EMIT", 'a' + i % 26);
+    code(g, "CR");
+    long emit_words = end(g);
+
+    define(g, "OUTPUT");
+    for (int i = 0; i < LINES / 2; i++) {
+        code(g, "LINE-EMIT");
+        code(g, "0 %d TYPE CR", LINE);
+    }
+    code(g, "DEPTH");
+    w->words = end(g) + LINES / 2 * emit_words;
+    w->run = "OUTPUT";
+    w->expected = 0;
+}
+
+static void sieve_script(Gen *g, Workload *w) {
+    g->script = true;
+    sieve(g, w);
+    w->run = NULL;
+}
+
+static void bubble_script(Gen *g, Workload *w) {
+    g->script = true;
+    bubble(g, w);
+    w->run = NULL;
+}
+
+static void matrix_script(Gen *g, Workload *w) {
+    g->script = true;
+    matrix(g, w);
+    w->run = NULL;
+}
+
+/* the index runs over addresses; words are counted per iteration for LOOP and +LOOP, once per loop for DO */
+static void sieve_loop(Gen *g, Workload *w) {
+    int outer = 0;
+    long inner = 0;
+
+    for (int i = 2; i * i < SIEVE_N; i++) {
+        outer++;
+        inner += (SIEVE_N - 1 - i * i) / i + 1;
+    }
+    fprintf(g->src, ": SIEVE-LOOP %d %d 0 FILL %d 2 DO %d %d I DUP * + DO 1 I ! J +LOOP LOOP %d %d CELLS-SUM ;\n",
+            SIEVE_BASE * (int)sizeof(Cell), SIEVE_N * (int)sizeof(Cell), outer + 2,
+            SIEVE_BASE + SIEVE_N, SIEVE_BASE, SIEVE_BASE, SIEVE_N);
+    w->words = 4 + 3 + outer * 8L + inner * 5 + 3;
+    w->run = "SIEVE-LOOP";
+    w->expected = sieve_marks();
+}
+
+static void bubble_loop(Gen *g, Workload *w) {
+    const int end = SORT_BASE + SORT_N;
+    long steps = (long)SORT_N * (SORT_N - 1) / 2;
+
+    fprintf(g->src, ": BUBBLE-LOOP %d %d DO %d I - I ! LOOP\n", end, SORT_BASE, end);
+    fprintf(g->src, "  1 %d DO %d I + %d DO I @ I 1+ @ OVER OVER MAX I 1+ ! MIN I ! LOOP -1 +LOOP\n",
+            SORT_N - 1, SORT_BASE, SORT_BASE);
+    fprintf(g->src, "  %d @ 1000 * %d @ + ;\n", SORT_BASE, end - 1);
+    w->words = 3 + SORT_N * 6L + 3 + (SORT_N - 1) * 7L + steps * 14 + 7;
+    w->run = "BUBBLE-LOOP";
+    w->expected = 1 * 1000 + SORT_N;
+}
+
+/* rows of A by address, columns j, and a dot product stepping through A's row and B's column */
+static void matrix_loop(Gen *g, Workload *w) {
+    const int n = MAT_N;
+    int sum = matrix_setup(g);
+
+    fprintf(g->src, ": MATMUL-LOOP %d %d DO %d 0 DO\n", MAT_A + n * n, MAT_A, n);
+    fprintf(g->src, "  0 I %d + J %d + J DO I @ OVER @ * ROT + SWAP %d + LOOP\n", MAT_B, n, n);
+    fprintf(g->src, "  DROP J I + %d + ! LOOP %d +LOOP %d %d CELLS-SUM ;\n", MAT_C - MAT_A, n, MAT_C, n * n);
+    w->words = 3 + n * 5L + n * n * 17L + (long)n * n * n * 11 + 3;
+    w->run = "MATMUL-LOOP";
+    w->expected = sum;
+}
+
+#define SWITCH_TASKS    8
+#define SWITCH_ROUNDS   5000
+#define SWITCH_COUNT    1000
+
+/* every task counts and PAUSEs ROUNDS times; the interpreter PAUSEs until they have all ended */
+static void task_switch(Gen *g, Workload *w) {
+    const long tasks = SWITCH_TASKS, rounds = SWITCH_ROUNDS;
+
+    fprintf(g->src, ": SPIN 0 DO PAUSE %d @ 1+ %d ! LOOP ;\n", SWITCH_COUNT, SWITCH_COUNT);
+    fprintf(g->src, ": SWITCHES 0 %d ! %ld 0 DO %ld ' SPIN SPAWN LOOP BEGIN PAUSE TASKS 0= UNTIL %d @ ;\n",
+            SWITCH_COUNT, tasks, rounds, SWITCH_COUNT);
+    /* a task's last switch is the one in which it returns */
+    w->words = 6 + tasks * 4 + (rounds + 1) * 4 + 2 + tasks * (3 + rounds * 7);
+    w->switches = tasks * (rounds + 1);
+    w->run = "SWITCHES";
+    w->expected = (int)(tasks * rounds);
+}
+
+#define IMAGE_XT        1000
+#define UNDEFINED_WORD  (-13)
+
+static char image_a[64];
+static char image_b[64];
+
+/* STALE is defined after A is saved: once A is loaded, no image saved after may bring it back */
+static void image(Gen *g, Workload *w) {
+    static char run[512];
+
+    snprintf(image_a, sizeof(image_a), "/tmp/yafi-bench-%ld-a.img", (long)getpid());
+    snprintf(image_b, sizeof(image_b), "/tmp/yafi-bench-%ld-b.img", (long)getpid());
+    fprintf(g->src, ": KEEP 7 ;\n' KEEP %d !\nSAVE-IMAGE %s\n: STALE 1 ;\n", IMAGE_XT, image_a);
+    snprintf(run, sizeof(run), "LOAD-IMAGE %s SAVE-IMAGE %s LOAD-IMAGE %s SAVE-IMAGE %s LOAD-IMAGE %s "
+             "' ' CATCH STALE %d @ EXECUTE +", image_a, image_b, image_b, image_b, image_b, IMAGE_XT);
+    w->words = 10 + 4 + 4 + 1;
+    w->run = run;
+    w->expected = UNDEFINED_WORD + 7;
+}
+
+static const struct {
+    const char *name;
+    void (*build)(Gen *g, Workload *w);
+} workloads[] = {
+    { "fib",            fib },
+    { "sieve",          sieve },
+    { "bubble-sort",    bubble },
+    { "matrix-multiply", matrix },
+    { "move-cmove",     copy },
+    { "emit-type",      output },
+    { "sieve-script",   sieve_script },
+    { "bubble-script",  bubble_script },
+    { "matrix-script",  matrix_script },
+    { "sieve-loop",     sieve_loop },
+    { "bubble-loop",    bubble_loop },
+    { "matrix-loop",    matrix_loop },
+    { "task-switch",    task_switch },
+    { "image-round-trip", image },
+};
+
+#define WORKLOADS   (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+/*
+ *  HARNESS
+ */
+
+static int compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* fills samples[0..runs) with seconds per evaluation; false if the workload failed */
+static bool measure(int index, Workload *w, FILE *sink, int runs, double *samples) {
+    Gen g = { NULL, 0, false };
+    char *setup = NULL;
+    size_t length = 0;
+    bool ok = true;
+    Cell value;
+
+    g.src = open_memstream(&setup, &length);
+    if (!g.src)
+        return false;
+    w->name = workloads[index].name;
+    w->switches = 0;
+    workloads[index].build(&g, w);
+    fclose(g.src);
+
+    const char *run = w->run ? w->run : setup;
+    size_t run_length = w->run ? strlen(w->run) : length;
+    Vm *vm = yafi_create(0, sink);
+    if (!vm || (w->run && !yafi_eval(vm, setup, length))) {
+        fprintf(stderr, "%s: setup failed\n", w->name);
+        ok = false;
+    }
+    for (int i = 0; i < runs && ok; i++) {
+        double start = now();
+        ok = yafi_eval(vm, run, run_length);
+        samples[i] = now() - start;
+        if (ok && (!yafi_pop(vm, &value) || value != w->expected || yafi_depth(vm) != 0)) {
+            fprintf(stderr, "%s: got %" PRIdCELL ", expected %d\n", w->name, value, w->expected);
+            ok = false;
+        }
+    }
+    yafi_destroy(vm);
+    free(setup);
+    return ok;
+}
+
+static void json_workload(FILE *json, const Workload *w, const double *samples, int runs, double median) {
+    fprintf(json, "    {\n");
+    fprintf(json, "      \"name\": \"%s\",\n", w->name);
+    fprintf(json, "      \"words\": %ld,\n", w->words);
+    fprintf(json, "      \"median_ns\": %.0f,\n", median * 1e9);
+    fprintf(json, "      \"median_ns_per_word\": %.3f,\n", median * 1e9 / w->words);
+    fprintf(json, "      \"words_per_sec\": %.0f,\n", w->words / median);
+    if (w->switches)
+        fprintf(json, "      \"switches_per_sec\": %.0f,\n", w->switches / median);
+    fprintf(json, "      \"samples_ns\": [");
+    for (int i = 0; i < runs; i++)
+        fprintf(json, "%s%.0f", i ? ", " : "", samples[i] * 1e9);
+    fprintf(json, "]\n    }");
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-n RUNS] [--no-jit] [results.json]\n", program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    static double samples[MAX_RUNS];
+    const char *results = NULL;
+    int runs = RUNS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+            if (runs <= 0 || runs > MAX_RUNS)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "--no-jit") == 0) {
+            jit_enabled = false;
+        } else if (argv[i][0] == '-' || results) {
+            usage(argv[0]);
+        } else {
+            results = argv[i];
+        }
+    }
+
+    FILE *sink = fopen("/dev/null", "w");
+    FILE *json = results ? fopen(results, "w") : NULL;
+    if (!sink || (results && !json)) {
+        perror(sink ? results : "/dev/null");
+        return EXIT_FAILURE;
+    }
+
+#ifdef YAFI_SWITCH_DISPATCH
+    const char *dispatch = "switch";
+#else
+    const char *dispatch = "direct";
+#endif
+#ifdef YAFI_JIT
+    bool jit = jit_enabled;
+#else
+    bool jit = false;
+#endif
+    if (json) {
+        fprintf(json, "{\n  \"runs\": %d,\n  \"dispatch\": \"%s\",\n  \"jit\": %s,\n  \"cell_bits\": %d,\n"
+                "  \"workloads\": [\n", runs, dispatch, jit ? "true" : "false", CELL_BITS);
+    }
+    fprintf(stdout, "%-16s %10s %12s %14s %10s   (%d runs, %s dispatch, %d-bit cells%s)\n", "workload", "words",
+            "ns/word", "words/sec", "us/run", runs, dispatch, CELL_BITS, jit ? ", JIT" : "");
+
+    bool ok = true;
+    int written = 0;
+    for (int i = 0; i < WORKLOADS; i++) {
+        Workload w;
+        if (!measure(i, &w, sink, runs, samples)) {
+            ok = false;
+            continue;
+        }
+        double sorted[MAX_RUNS];
+        memcpy(sorted, samples, runs * sizeof(double));
+        qsort(sorted, runs, sizeof(double), compare);
+        double median = sorted[runs / 2];
+
+        fprintf(stdout, "%-16s %10ld %12.2f %14.0f %10.1f\n", w.name, w.words, median * 1e9 / w.words,
+                w.words / median, median * 1e6);
+        if (w.switches)
+            fprintf(stdout, "%-16s %10ld switches, %.0f switches/sec\n", "", w.switches, w.switches / median);
+        if (json) {
+            if (written++ > 0)
+                fprintf(json, ",\n");
+            json_workload(json, &w, samples, runs, median);
+        }
+    }
+
+    if (json) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    remove(image_a);
+    remove(image_b);
+    fclose(sink);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,124 @@
+/*
+ * Microbenchmark: token classification throughput on a literal-heavy script.
+ * Compares the original strtok + to_uppercase + linear strcmp scan +
+ * is_number + atoi path, the same with find_entry(), and the single-pass
+ * lexer with find_token().
+ *
+ *   make bench-lookup
+ */
+
+#include <time.h>
+#include "../forth.h"
+#include "../Dictionary.h"
+#include "../Lexer.h"
+#include "../Vm.h"
+
+#define TOKENS      4096
+#define ROUNDS      500
+
+static DictEntry *find_entry_linear(const char *word) {
+    for (int i = 0; dictionary[i].word != NULL; i++) {
+        if (strcmp(dictionary[i].word, word) == 0) {
+            return &dictionary[i];
+        }
+    }
+    return NULL;
+}
+
+static void to_uppercase(char *str) {
+    for (; *str; ++str)
+        *str = toupper(*str);
+}
+
+static bool is_number(const char *token) {
+    if (*token == '-' || *token == '+')
+        token++;
+    if (!*token)
+        return false;
+    while (*token) {
+        if (!isdigit(*token))
+            return false;
+        token++;
+    }
+    return true;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* five literals for every word, the shape of a data-loading script */
+static size_t make_script(char *script) {
+    static const char *words[] = { "+", "dup", "!", "SWAP", "Drop", "C!", "OVER", "@" };
+    size_t length = 0;
+    for (int i = 0; i < TOKENS; i++) {
+        if (i % 6 == 5)
+            length += sprintf(script + length, "%s ", words[(i / 6) % 8]);
+        else
+            length += sprintf(script + length, "%d ", (i * 7919) % 100000 - 50000);
+    }
+    return length;
+}
+
+static double run_strtok(DictEntry *(*lookup)(const char *), const char *script, size_t length, long *sum) {
+    static char line[TOKENS * 16];
+    long total = 0;
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        memcpy(line, script, length + 1);
+        for (char *token = strtok(line, " \t\r\n"); token; token = strtok(NULL, " \t\r\n")) {
+            to_uppercase(token);
+            DictEntry *entry = lookup(token);
+            if (entry)
+                total += entry->opcode;
+            else if (is_number(token))
+                total += atoi(token);
+        }
+    }
+    *sum = total;
+    return (double)TOKENS * ROUNDS / (now() - start);
+}
+
+static double run_lexer(const char *script, size_t length, long *sum) {
+    long total = 0;
+    double start = now();
+    for (int r = 0; r < ROUNDS; r++) {
+        Lexer lexer;
+        Token token;
+        lexer_begin(&lexer, script, length);
+        while (next_token(&lexer, &token, 10)) {
+            DictEntry *entry = find_token(&token);
+            if (entry)
+                total += entry->opcode;
+            else if (token.is_number)
+                total += token.value;
+        }
+    }
+    *sum = total;
+    return (double)TOKENS * ROUNDS / (now() - start);
+}
+
+int main(void) {
+    static char script[TOKENS * 16];
+    long linear_sum, hashed_sum, lexer_sum;
+
+    VmConfig config = vm_defaults();
+    init_dictionary();
+    vm_enter(vm_create(&config));
+    size_t length = make_script(script);
+
+    double linear = run_strtok(find_entry_linear, script, length, &linear_sum);
+    double hashed = run_strtok(find_entry, script, length, &hashed_sum);
+    double lexed = run_lexer(script, length, &lexer_sum);
+    if (linear_sum != hashed_sum || hashed_sum != lexer_sum) {
+        fprintf(stderr, "classification mismatch: %ld, %ld, %ld\n", linear_sum, hashed_sum, lexer_sum);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stdout, "linear scan : %12.0f tokens/sec\n", linear);
+    fprintf(stdout, "hashed      : %12.0f tokens/sec (%.1fx)\n", hashed, hashed / linear);
+    fprintf(stdout, "lexer       : %12.0f tokens/sec (%.1fx)\n", lexed, lexed / linear);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+/*
+ * Microbenchmark: output throughput of EMIT, SPACES, TYPE and '.' in
+ * bytes/sec, against the old putchar + fflush per character. Output goes
+ * to /dev/null (or the file given) so only the write path is measured.
+ *
+ *   make bench-output
+ */
+
+#include <time.h>
+#include <unistd.h>
+#include "../forth.h"
+#include "../Output.h"
+#include "../Vm.h"
+
+#define BYTES       (8 * 1024 * 1024)
+#define LINE        64
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double emit_unbuffered(Stack *s, Cell *m) {
+    (void)s; (void)m;
+    double start = now();
+    for (long i = 0; i < BYTES; i++) {
+        putchar((i % LINE == LINE - 1) ? '\n' : 'x');
+        fflush(stdout);
+    }
+    return BYTES / (now() - start);
+}
+
+static double emit(Stack *s, Cell *m) {
+    (void)m;
+    double start = now();
+    for (long i = 0; i < BYTES; i++) {
+        push(s, (i % LINE == LINE - 1) ? '\n' : 'x');
+        op_emit(s);
+    }
+    output_flush();
+    return BYTES / (now() - start);
+}
+
+static double spaces(Stack *s, Cell *m) {
+    (void)m;
+    double start = now();
+    for (long i = 0; i < BYTES / LINE; i++) {
+        push(s, LINE - 1);
+        op_spaces(s);
+        op_cr();
+    }
+    output_flush();
+    return BYTES / (now() - start);
+}
+
+static double type(Stack *s, Cell *m) {
+    for (int i = 0; i < LINE; i++)
+        m[i] = (i == LINE - 1) ? '\n' : 'a' + i % 26;
+    double start = now();
+    for (long i = 0; i < BYTES / LINE; i++) {
+        push(s, 0);
+        push(s, LINE);
+        op_type(s, m);
+    }
+    output_flush();
+    return BYTES / (now() - start);
+}
+
+static int printed_length(int value) {
+    int length = (value < 0) ? 3 : 2;
+    for (long v = labs((long)value); v >= 10; v /= 10)
+        length++;
+    return length;
+}
+
+static double print(Stack *s, Cell *m) {
+    long bytes = 0;
+    double start = now();
+    for (int i = 0; bytes < BYTES; i++) {
+        push(s, i * 7919);
+        op_print(s, m);
+        bytes += printed_length(i * 7919);
+    }
+    output_flush();
+    return bytes / (now() - start);
+}
+
+int main(int argc, char *argv[]) {
+    static struct { const char *name; double (*run)(Stack *, Cell *); } cases[] = {
+        { "EMIT, fflush per char", emit_unbuffered },
+        { "EMIT",                  emit            },
+        { "SPACES",                spaces          },
+        { "TYPE",                  type            },
+        { ".",                     print           },
+    };
+    static const char *policies[] = { "line", "size" };
+    VmConfig config = vm_defaults();
+
+    FILE *report = fdopen(dup(STDOUT_FILENO), "w");
+    if (!report || !freopen(argc > 1 ? argv[1] : "/dev/null", "w", stdout)) {
+        perror("output_bench");
+        return EXIT_FAILURE;
+    }
+
+    output_init();
+    Vm *vm = vm_create(&config);
+    vm_enter(vm);
+    for (int p = 0; p < 2; p++) {
+        output_set_policy(p == 0 ? FLUSH_LINE : FLUSH_SIZE);
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+            if (i == 0 && p > 0)
+                continue;
+            double rate = cases[i].run(&vm->stack, vm->memory.data);
+            fprintf(report, "%-22s flush=%-4s : %10.1f MB/sec\n",
+                    cases[i].name, policies[p], rate / (1024 * 1024));
+        }
+    }
+    fclose(report);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+/*
+ * Benchmark: PAR-MAP and PAR-REDUCE scaling. Each kernel runs over the
+ * same array on 1, 2, 4 ... threads up to the number of cores; the median
+ * time gives the speedup over one thread. Every thread count must leave
+ * the same checksum, which is also what makes a reduction deterministic.
+ *
+ *   make bench-par
+ *   bench/par_bench [-n RUNS] [--threads=MAX]
+ */
+
+#include <time.h>
+#include <unistd.h>
+#include "../yafi.h"
+#include "../Par.h"
+
+#define CELLS       (1024 * 1024)
+#define ARRAY       1024        /* cell address of the array the kernels run over */
+#define LENGTH      1000000     /* both written out in the kernels below */
+#define RUNS        5
+#define MAX_RUNS    101
+
+static const struct {
+    const char *name;
+    const char *setup;
+    const char *run;        /* leaves a checksum */
+} kernels[] = {
+    /* straight-line, so the JIT compiles it */
+    { "map-poly-jit",
+      ": POLY DUP * 7 + 65535 AND DUP * 7 + 65535 AND DUP * 7 + 65535 AND DUP * 7 + 65535 AND ;\n"
+      ": SUM + ;\n",
+      "1024 1000000 ' POLY PAR-MAP 1024 1000000 ' SUM 0 PAR-REDUCE" },
+    /* a DO loop, which stays threaded code */
+    { "map-poly-loop",
+      ": POLY-LOOP 16 0 DO DUP * 7 + 65535 AND LOOP ;\n"
+      ": SUM + ;\n",
+      "1024 1000000 ' POLY-LOOP PAR-MAP 1024 1000000 ' SUM 0 PAR-REDUCE" },
+    { "reduce-max",
+      ": BIGGER MAX ;\n",
+      "1024 1000000 ' BIGGER 0 PAR-REDUCE" },
+};
+
+#define KERNELS     (int)(sizeof(kernels) / sizeof(kernels[0]))
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* the same pseudo-random cells before every run */
+static void refill(Vm *vm) {
+    size_t cells;
+    Cell *memory = yafi_memory(vm, &cells);
+    uint32_t x = 2463534242u;
+    for (size_t i = ARRAY; i < ARRAY + LENGTH; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        memory[i] = (Cell)(x & 0xFFFF);
+    }
+}
+
+/* median seconds per run; false if the kernel failed */
+static bool measure(Vm *vm, int kernel, int runs, double *median, Cell *checksum) {
+    double samples[MAX_RUNS];
+    for (int i = 0; i < runs; i++) {
+        refill(vm);
+        double start = now();
+        bool ok = yafi_eval(vm, kernels[kernel].run, strlen(kernels[kernel].run));
+        samples[i] = now() - start;
+        if (!ok || !yafi_pop(vm, checksum) || yafi_depth(vm) != 0) {
+            fprintf(stderr, "%s: failed\n", kernels[kernel].name);
+            return false;
+        }
+    }
+    qsort(samples, runs, sizeof(double), compare);
+    *median = samples[runs / 2];
+    return true;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-n RUNS] [--threads=MAX]\n", program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int max = (cores < 1) ? 1 : (cores > PAR_MAX_THREADS) ? PAR_MAX_THREADS : (int)cores;
+    int runs = RUNS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+            if (runs <= 0 || runs > MAX_RUNS)
+                usage(argv[0]);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            max = atoi(argv[i] + 10);
+            if (max <= 0 || max > PAR_MAX_THREADS)
+                usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    FILE *sink = fopen("/dev/null", "w");
+    if (!sink) {
+        perror("/dev/null");
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "%-16s %8s %12s %10s %14s   (%d runs, %ld cores)\n", "kernel", "threads", "ms/run",
+            "speedup", "checksum", runs, cores);
+
+    bool ok = true;
+    for (int k = 0; k < KERNELS && ok; k++) {
+        Vm *vm = yafi_create(CELLS, sink);
+        if (!vm || !yafi_eval(vm, kernels[k].setup, strlen(kernels[k].setup))) {
+            fprintf(stderr, "%s: setup failed\n", kernels[k].name);
+            return EXIT_FAILURE;
+        }
+        double single = 0;
+        Cell expected = 0;
+        for (int threads = 1; threads <= max && ok; threads = (threads * 2 > max && threads < max) ? max : threads * 2) {
+            double median;
+            Cell checksum;
+            par_threads = threads;
+            ok = measure(vm, k, runs, &median, &checksum);
+            if (!ok)
+                break;
+            if (threads == 1) {
+                single = median;
+                expected = checksum;
+            } else if (checksum != expected) {
+                fprintf(stderr, "%s: %d threads gave %" PRIdCELL ", 1 thread %" PRIdCELL "\n",
+                        kernels[k].name, threads, checksum, expected);
+                ok = false;
+            }
+            fprintf(stdout, "%-16s %8d %12.2f %10.2f %14" PRIdCELL "\n", kernels[k].name, threads, median * 1e3,
+                    single / median, checksum);
+        }
+        yafi_destroy(vm);
+    }
+    fclose(sink);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
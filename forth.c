@@ -1,124 +1,173 @@
-#include "Forth.h"
+#include "forth.h"
+#include "Dictionary.h"
+#include "Compiler.h"
+#include "Engine.h"
+#include "Peephole.h"
+#include "Output.h"
+#include "Lexer.h"
+#include "Bulk.h"
+#include "Vm.h"
+#include "Image.h"
+#include "Par.h"
 
 /*
  *  Memory
  */
 
+_Thread_local int memory_cells = MEMORY_SIZE;
+
 /* @ -> fetch from memory address [M.01] */
-void op_fetch(Stack *s, int *m) {
-    int addr = pop(s);
-    if (addr < 0 || addr >= MEMORY_SIZE) {
-        fprintf(stderr, "Memory access out of bounds at @\n");
-        exit(EXIT_FAILURE);
+void op_fetch(Stack *s, Cell *m) {
+    Cell addr = pop(s);
+    if (OUT_OF_BOUNDS(addr, memory_cells)) {
+        vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds at @\n");
     }
     push(s, m[addr]);
 }
 
 /* ! -> store to memory address [M.02] */
-void op_store(Stack *s, int *m) {
-    int addr = pop(s);
-    int value = pop(s);
-    if (addr < 0 || addr >= MEMORY_SIZE) {
-        fprintf(stderr, "Memory access out of bounds at !\n");
-        exit(EXIT_FAILURE);
+void op_store(Stack *s, Cell *m) {
+    Cell addr = pop(s);
+    Cell value = pop(s);
+    if (OUT_OF_BOUNDS(addr, memory_cells)) {
+        vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds at !\n");
     }
     m[addr] = value;
 }
 
 /* C@ -> CFETCH -> fetch a byte [M.03] */
 void op_cfetch(Stack *s, uint8_t *m) {
-    int addr = pop(s);
-    if (addr < 0 || addr >= MEMORY_SIZE) {
-        fprintf(stderr, "Memory access out of bounds in C@\n");
-        exit(EXIT_FAILURE);
+    Cell addr = pop(s);
+    if (BYTE_OUT_OF_BOUNDS(addr, memory_cells)) {
+        vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds in C@\n");
     }
-    uint8_t byte = ((uint8_t *)m)[addr];
-    push(s, byte);
+    push(s, m[addr]);
 }
 
 /* C! -> CSTORE -> store a byte [M.04] */
 void op_cstore(Stack *s, uint8_t *m) {
-    int addr = pop(s);
-    int value = pop(s);
-    if (addr < 0 || addr >= MEMORY_SIZE) {
-        fprintf(stderr, "Memory access out of bounds in C!\n");
-        exit(EXIT_FAILURE);
+    Cell addr = pop(s);
+    Cell value = pop(s);
+    if (BYTE_OUT_OF_BOUNDS(addr, memory_cells)) {
+        vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds in C!\n");
     }
     m[addr] = (uint8_t)(value & 0xFF);
 }
 
 /* ? [M.05] */
-void op_question(Stack *s, int *m) {
-    int addr = pop(s);
-    if (addr < 0 || addr >= MEMORY_SIZE) {
-        fprintf(stderr, "Memory access out of bounds at !\n");
-        exit(EXIT_FAILURE);
+void op_question(Stack *s, Cell *m) {
+    Cell addr = pop(s);
+    if (OUT_OF_BOUNDS(addr, memory_cells)) {
+        vm_throw(THROW_INVALID_ADDRESS, "Memory access out of bounds at !\n");
     }
-    int value = *((int *)(m + addr));
-    fprintf(stdout, "%d\n", value);
+    output_number(m[addr], number_base(m));
+}
+
+/* [addr, addr + count) lies inside memory of 'limit' units; neither may be negative */
+static inline bool in_memory(Cell addr, Cell count, size_t limit) {
+    return (UCell)addr <= limit && (UCell)count <= limit - (size_t)addr;
 }
 
 /* MOVE [M.07] */
 void op_move(Stack *s, uint8_t *m) {
-    int u = pop(s);       // number of bytes
-    int dest = pop(s);    // destination addr
-    int src = pop(s);     // source addr
+    Cell u = pop(s);       // number of bytes
+    Cell dest = pop(s);    // destination addr
+    Cell src = pop(s);     // source addr
 
     if (u <= 0) 
         return;
-
-    if (src < dest && src + u > dest) {
-        // Overlapping, copy backwards
-        for (int i = u - 1; i >= 0; i--) {
-            m[dest + i] = m[src + i];
-            fprintf(stdout, "m[%d] = m[%d] -> m[%d] = %d\n", dest+i, src+i, dest+i, m[dest + i]);
-        }
-    } 
-    else {
-        // No overlap or safe to copy forwards
-        for (int i = 0; i < u; i++) {
-            m[dest + i] = m[src + i];
-            fprintf(stdout, "m[%d] = m[%d] -> m[%d] = %d\n", dest+i, src+i, dest+i, m[dest + i]);
-        }
+    if (src < 0 || dest < 0 || !in_memory(src, u, (size_t)memory_cells * sizeof(Cell))
+            || !in_memory(dest, u, (size_t)memory_cells * sizeof(Cell))) {
+        vm_throw(THROW_INVALID_ADDRESS, "MOVE error: Memory access out of bounds\n");
     }
+    // overlapping ranges are fine: the copy behaves as if through a buffer
+    bulk_copy(m + dest, m + src, (size_t)u);
 }
 
 /* CMOVE [M.08] */
 void op_cmove(Stack *s, uint8_t *m) {
-    int count = pop(s);
-    int src = pop(s);
-    int dest = pop(s);
+    Cell count = pop(s);
+    Cell src = pop(s);
+    Cell dest = pop(s);
     if (count < 0 || src < 0 || dest < 0) {
-        fprintf(stderr, "CMOVE error: Negative address or count\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_INVALID_ADDRESS, "CMOVE error: Negative address or count\n");
     }
-    uint32_t ucount = (uint32_t)count;
-    uint32_t usrc = (uint32_t)src;
-    uint32_t udest = (uint32_t)dest;
-    uint32_t mem_size_bytes = MEMORY_SIZE * sizeof(int);
-    if (usrc + ucount > mem_size_bytes || udest + ucount > mem_size_bytes) {
-        fprintf(stderr, "CMOVE error: Memory access out of bounds\n");
-        exit(EXIT_FAILURE);
+    if (!in_memory(src, count, (size_t)memory_cells * sizeof(Cell)) || !in_memory(dest, count, (size_t)memory_cells * sizeof(Cell))) {
+        vm_throw(THROW_INVALID_ADDRESS, "CMOVE error: Memory access out of bounds\n");
     }
-    memmove(m + udest, m + usrc, ucount);
+    bulk_copy(m + dest, m + src, (size_t)count);
 }
 
 /* FILL [M.09] */
 void op_fill(Stack *s, uint8_t *m) {
-    int value = pop(s);    // value to fill
-    int count = pop(s);    // number of bytes to fill
-    int addr = pop(s);     // destination address
+    Cell value = pop(s);    // value to fill
+    Cell count = pop(s);    // number of bytes to fill
+    Cell addr = pop(s);     // destination address
     if (addr < 0 || count < 0) {
-        fprintf(stderr, "FILL error: Negative address or count\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_INVALID_ADDRESS, "FILL error: Negative address or count\n");
     }
-    size_t uaddr = (size_t)addr;
-    size_t ucount = (size_t)count;
-    if (uaddr + ucount > MEMORY_SIZE * sizeof(int)) {
-        fprintf(stderr, "FILL error: Memory access out of bounds\n");
-        exit(EXIT_FAILURE);
+    if (!in_memory(addr, count, (size_t)memory_cells * sizeof(Cell))) {
+        vm_throw(THROW_INVALID_ADDRESS, "FILL error: Memory access out of bounds\n");
     }
-    memset(m + uaddr, value, ucount);
+    bulk_fill(m + addr, value, (size_t)count);
+}
+
+/* cell ranges for the array words: addr and n in cells */
+static void check_cells(Cell addr, Cell n, bool nonempty, const char *word) {
+    if (addr < 0 || n < 0 || !in_memory(addr, n, (size_t)memory_cells)) {
+        vm_throw(THROW_INVALID_ADDRESS, "%s error: Memory access out of bounds\n", word);
+    }
+    if (nonempty && n == 0) {
+        vm_throw(THROW_INVALID_ARGUMENT, "%s error: Empty range\n", word);
+    }
+}
+
+/* CELLS-SUM ( addr n -- sum ) [M.10] */
+void op_cells_sum(Stack *s, Cell *m) {
+    Cell n = pop(s);
+    Cell addr = pop(s);
+    check_cells(addr, n, false, CSUM);
+    push(s, bulk()->sum(m + addr, (size_t)n));
+}
+
+/* CELLS-MIN ( addr n -- min ) [M.11] */
+void op_cells_min(Stack *s, Cell *m) {
+    Cell n = pop(s);
+    Cell addr = pop(s);
+    check_cells(addr, n, true, CMIN);
+    push(s, bulk()->min(m + addr, (size_t)n));
+}
+
+/* CELLS-MAX ( addr n -- max ) [M.12] */
+void op_cells_max(Stack *s, Cell *m) {
+    Cell n = pop(s);
+    Cell addr = pop(s);
+    check_cells(addr, n, true, CMAX);
+    push(s, bulk()->max(m + addr, (size_t)n));
+}
+
+/* CELLS-COMPARE ( addr1 addr2 n -- -1|0|1 ) first differing cell decides [M.13] */
+void op_cells_compare(Stack *s, Cell *m) {
+    Cell n = pop(s);
+    Cell addr2 = pop(s);
+    Cell addr1 = pop(s);
+    check_cells(addr1, n, false, CCMP);
+    check_cells(addr2, n, false, CCMP);
+    size_t i = bulk()->mismatch(m + addr1, m + addr2, (size_t)n);
+    if (i == (size_t)n)
+        push(s, 0);
+    else
+        push(s, (m[addr1 + i] < m[addr2 + i]) ? -1 : 1);
+}
+
+/* CELLS-SEARCH ( addr n value -- index ) index from addr, -1 when absent [M.14] */
+void op_cells_search(Stack *s, Cell *m) {
+    Cell value = pop(s);
+    Cell n = pop(s);
+    Cell addr = pop(s);
+    check_cells(addr, n, false, CFIND);
+    size_t i = bulk()->search(m + addr, (size_t)n, value);
+    push(s, (i == (size_t)n) ? -1 : (Cell)i);
 }
 
 
@@ -138,8 +187,8 @@ void op_drop(Stack *s) {
 
 /* SWAP [S.03] */
 void op_swap(Stack *s) {
-    int a = pop(s);
-    int b = pop(s);
+    Cell a = pop(s);
+    Cell b = pop(s);
     push(s, a);
     push(s, b);
 }
@@ -147,22 +196,20 @@ void op_swap(Stack *s) {
 /* OVER [S.04] */
 void op_over(Stack *s) {
     if (!stack_has_min_depth(s, 2)) {
-        fprintf(stderr, "Stack underflow for OVER!\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_STACK_UNDERFLOW, "Stack underflow for OVER!\n");
     }
-    int x = s->data[s->top - 2];
+    Cell x = s->data[s->top - 2];
     push(s, x);
 }
 
 /* ROT [S.05] */
 void op_rot(Stack *s) {
     if (!stack_has_min_depth(s, 3)) {
-        fprintf(stderr, "Stack underflow for ROT!\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_STACK_UNDERFLOW, "Stack underflow for ROT!\n");
     }
-    int c = pop(s);    
-    int b = pop(s);     
-    int a = pop(s);     
+    Cell c = pop(s);    
+    Cell b = pop(s);     
+    Cell a = pop(s);     
     push(s, b);         
     push(s, c);         
     push(s, a);        
@@ -171,31 +218,27 @@ void op_rot(Stack *s) {
 /* PICK [S.06] */
 void op_pick(Stack *s) {
     if (s->top < 1) {
-        fprintf(stderr, "Stack underflow for PICK!\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_STACK_UNDERFLOW, "Stack underflow for PICK!\n");
     }
-    int n = pop(s);  // the index
+    Cell n = pop(s);  // the index
     if (n < 0 || n > s->top) {
-        fprintf(stderr, "Invalid PICK index: %d\n", n);
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_INVALID_ARGUMENT, "Invalid PICK index: %" PRIdCELL "\n", n);
     }
-    int value = s->data[s->top - 1 - n];
+    Cell value = s->data[s->top - 1 - n];
     push(s, value);
 }
 
 /* ROLL [S.07] */
 void op_roll(Stack *s) {
     if (s->top < 1) {
-        fprintf(stderr, "Stack underflow for ROLL!\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_STACK_UNDERFLOW, "Stack underflow for ROLL!\n");
     }
-    int n = pop(s);  // depth to roll
+    Cell n = pop(s);  // depth to roll
     if (n < 0 || n >= s->top) {
-        fprintf(stderr, "Invalid ROLL index: %d\n", n);
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_INVALID_ARGUMENT, "Invalid ROLL index: %" PRIdCELL "\n", n);
     }
-    int index = s->top - 1 - n;
-    int value = s->data[index];
+    int index = s->top - 1 - (int)n;
+    Cell value = s->data[index];
     for (int i = index; i < s->top - 1; i++) {
         s->data[i] = s->data[i + 1];
     }
@@ -210,80 +253,97 @@ void op_depth(Stack *s) {
 /* >R -> TO R [S.10] */
 void op_to_r(Stack *s, Stack *rs) {
     if (s->top == 0) {
-        fprintf(stderr, "Stack underflow for >R!\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_STACK_UNDERFLOW, "Stack underflow for >R!\n");
     }
-    int value = pop(s);
+    Cell value = pop(s);
     push(rs, value);
 }
 
 /* R> -> R FROM [S.11] */
 void op_r_from(Stack *s, Stack *rs) {
     if (rs->top == 0) {
-        fprintf(stderr, "Return stack underflow for R>!\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_RSTACK_UNDERFLOW, "Return stack underflow for R>!\n");
     }
-    int value = pop(rs);
+    Cell value = pop(rs);
     push(s, value);
 }
 
 /* R@ -> R FETCH [S.12] */
 void op_r_fetch(Stack *s, Stack *rs) {
     if (rs->top == 0) {
-        fprintf(stderr, "Return stack empty for R@!\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_RSTACK_UNDERFLOW, "Return stack empty for R@!\n");
     }
-    int value = rs->data[rs->top - 1];
+    Cell value = rs->data[rs->top - 1];
     push(s, value);
 }
 
 
+/* a double number takes two cells, the high half on top */
+static DCell pop_double(Stack *s) {
+    UCell high = (UCell)pop(s);
+    UCell low = (UCell)pop(s);
+    return (DCell)(((UDCell)high << CELL_BITS) | low);
+}
+
+static void push_double(Stack *s, DCell value) {
+    push(s, (Cell)(UCell)value);
+    push(s, (Cell)(UCell)((UDCell)value >> CELL_BITS));
+}
+
+
 /* 
  *  COMPARE
  */
 
 /* LT -> LESS THAN [C.01] */
 void op_less_than(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     push(s, (a < b) ? -1 : 0);
 }
 
 /* EQ -> EQUAL [C.02] */
 void op_equal(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     push(s, (a == b) ? -1 : 0);
 }
 
 /* GT -> GREATER THAN [C.03] */
 void op_greater_than(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     push(s, (a > b) ? -1 : 0);
 }
 
 /* NEG [C.04] */
 void op_zero_less(Stack *s) {
-    int a = pop(s);
+    Cell a = pop(s);
     push(s, (a < 0) ? -1 : 0);
 }
 
 /* ZERO [C.05] */
 void op_zero_equal(Stack *s) {
-    int a = pop(s);
+    Cell a = pop(s);
     push(s, (a == 0) ? -1 : 0);
 }
 
 /* POS [C.06] */
 void op_zero_greater(Stack *s) {
-    int a = pop(s);
+    Cell a = pop(s);
     push(s, (a > 0) ? -1 : 0);
 }
 
+/* D< ( d1 d2 -- flag ) [C.07] */
+void op_d_less(Stack *s) {
+    DCell d2 = pop_double(s);
+    DCell d1 = pop_double(s);
+    push(s, (d1 < d2) ? -1 : 0);
+}
+
 /* NOT [C.09] */
 void op_not(Stack *s) {
-    int a = pop(s);
+    Cell a = pop(s);
     push(s, ~a);
 }
 
@@ -294,59 +354,65 @@ void op_not(Stack *s) {
 
  /* ADD [L.01] */
 void op_add(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     push(s, a + b);
 }
 
 /* SUB [L.02] */
 void op_sub(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     push(s, a - b);
 }
 
 /* MUL [L.03] */
 void op_mul(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     push(s, a * b);
 }
 
 /* DIV [L.04] */
 void op_div(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     if (b == 0) {
-        fprintf(stderr, "Division by zero!\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_DIVISION_BY_ZERO, "Division by zero!\n");
+    }
+    if (a == CELL_MIN && b == -1) {
+        vm_throw(THROW_RESULT_OUT_OF_RANGE, "Division overflow!\n");
     }
     push(s, a / b);
 }
 
 /* MOD [L.05] */
 void op_mod(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     if (b == 0) {
-        fprintf(stderr, "Modulo by zero!\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_DIVISION_BY_ZERO, "Modulo by zero!\n");
+    }
+    if (a == CELL_MIN && b == -1) {
+        vm_throw(THROW_RESULT_OUT_OF_RANGE, "Modulo overflow!\n");
     }
     push(s, a % b);
 }
 
 /* DIVMOD [L.06] */
 void op_divmod(Stack *s) {
-    int divisor = pop(s);
-    int dividend = pop(s);
+    Cell divisor = pop(s);
+    Cell dividend = pop(s);
 
     if (divisor == 0) {
-        fprintf(stderr, "/MOD error: Division by zero\n");
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_DIVISION_BY_ZERO, "/MOD error: Division by zero\n");
+    }
+    if (dividend == CELL_MIN && divisor == -1) {
+        vm_throw(THROW_RESULT_OUT_OF_RANGE, "/MOD error: Result out of range\n");
     }
 
-    int quotient = dividend / divisor;
-    int remainder = dividend % divisor;
+    Cell quotient = dividend / divisor;
+    Cell remainder = dividend % divisor;
 
     push(s, remainder);
     push(s, quotient);
@@ -373,86 +439,126 @@ void op_two_minus(Stack *s) {
     push(s, pop(s) - 2);
 }
 
-/* D+ [L.11] */
+/* D+ ( d1 d2 -- d1+d2 ) [L.11] */
 void op_d_plus(Stack *s) {
-    int d2_high = pop(s);
-    int d2_low  = pop(s);
-    int d1_high = pop(s);
-    int d1_low  = pop(s);
+    UDCell d2 = (UDCell)pop_double(s);
+    UDCell d1 = (UDCell)pop_double(s);
+    push_double(s, (DCell)(d1 + d2));
+}
 
-    unsigned int low_sum = (unsigned int)d1_low + (unsigned int)d2_low;
-    int carry = (low_sum < (unsigned int)d1_low); // overflow detection
+/* M* ( n1 n2 -- d ) [L.12] */
+void op_m_star(Stack *s) {
+    Cell b = pop(s);
+    Cell a = pop(s);
+    push_double(s, (DCell)a * b);
+}
 
-    int high_sum = d1_high + d2_high + carry;
+/* UM* ( u1 u2 -- ud ) [L.13] */
+void op_um_star(Stack *s) {
+    UCell b = (UCell)pop(s);
+    UCell a = (UCell)pop(s);
+    push_double(s, (DCell)((UDCell)a * b));
+}
 
-    push(s, low_sum);
-    push(s, high_sum);
+/* UM/MOD ( ud u -- urem uquot ) [L.14] */
+void op_um_slash_mod(Stack *s) {
+    UCell divisor = (UCell)pop(s);
+    UDCell dividend = (UDCell)pop_double(s);
+    if (divisor == 0) {
+        vm_throw(THROW_DIVISION_BY_ZERO, "UM/MOD error: Division by zero\n");
+    }
+    UDCell quotient = dividend / divisor;
+    if (quotient > (UCell)-1) {
+        vm_throw(THROW_RESULT_OUT_OF_RANGE, "UM/MOD error: Result out of range\n");
+    }
+    push(s, (Cell)(UCell)(dividend % divisor));
+    push(s, (Cell)(UCell)quotient);
+}
+
+/* n1*n2 is kept as a double number, so only a quotient too big for a cell fails */
+static void star_slash(Stack *s, Cell *remainder, Cell *quotient, const char *word) {
+    Cell divisor = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
+    if (divisor == 0) {
+        vm_throw(THROW_DIVISION_BY_ZERO, "%s error: Division by zero\n", word);
+    }
+    DCell product = (DCell)a * b;
+    DCell result = product / divisor;
+    if (result != (Cell)result) {
+        vm_throw(THROW_RESULT_OUT_OF_RANGE, "%s error: Result out of range\n", word);
+    }
+    *quotient = (Cell)result;
+    *remainder = (Cell)(product % divisor);
+}
+
+/* star-slash ( n1 n2 n3 -- n1*n2/n3 ) [L.15] */
+void op_star_slash(Stack *s) {
+    Cell remainder, quotient;
+    star_slash(s, &remainder, &quotient, SSLASH);
+    push(s, quotient);
 }
 
 /* MAX [L.16] */
 void op_max(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     push(s, (a > b) ? a : b);
 }
 
 /* MIN [L.17] */
 void op_min(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     push(s, (a < b) ? a : b);
 }
 
 /* ABS [L.18] */
 void op_abs(Stack *s) {
-    int a = pop(s);
+    Cell a = pop(s);
     push(s, (a < 0) ? -a : a);
 }
 
 /* NEGATE [L.19] */
 void op_negate(Stack *s) {
-    int a = pop(s);
+    Cell a = pop(s);
     push(s, -a);
 }
 
-/* DNEGATE [L.20] */
+/* DNEGATE ( d -- -d ) [L.20] */
 void op_dnegate(Stack *s) {
-    if (s->top < 2) {
-        fprintf(stderr, "Stack underflow for DNEGATE\n");
-        return;
-    }
-
-    int high = pop(s);
-    int low  = pop(s);
-
-    int64_t value = ((int64_t)(uint32_t)high << 32) | (uint32_t)low;
-    value = -value;
-
-    push(s, (int)(value >> 32));       // high part
-    push(s, (int)(value & 0xFFFFFFFF)); // low part
+    push_double(s, (DCell)(0 - (UDCell)pop_double(s)));
 }
 
 /* AND [L.21] */
 void op_and(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     push(s, a & b);
 }
 
 /* OR [L.22] */
 void op_or(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     push(s, a | b);
 }
 
 /* XOR [L.23] */
 void op_xor(Stack *s) {
-    int b = pop(s);
-    int a = pop(s);
+    Cell b = pop(s);
+    Cell a = pop(s);
     push(s, a ^ b);
 }
 
+/* star-slash-MOD ( n1 n2 n3 -- rem quot ) [L.24] */
+void op_star_slash_mod(Stack *s) {
+    Cell remainder, quotient;
+    star_slash(s, &remainder, &quotient, SSLASHMOD);
+    push(s, remainder);
+    push(s, quotient);
+}
+
 
 /*
  *  INPUT/OUTPUT - CHARACTERS 
@@ -460,73 +566,117 @@ void op_xor(Stack *s) {
 
 /* CR [IOC.01] */
 void op_cr() {
-    putchar('\n');
-    fflush(stdout);
+    output_char('\n');
 }
 
 /* EMIT [IOC.02] */
 void op_emit(Stack *s) {
-    int value = pop(s);
+    Cell value = pop(s);
     if (value < 0 || value > 255) {
-        fprintf(stderr, "Invalid EMIT value: %d\n", value);
-        exit(EXIT_FAILURE);
+        vm_throw(THROW_INVALID_ARGUMENT, "Invalid EMIT value: %" PRIdCELL "\n", value);
     }
-    putchar(value);
-    fflush(stdout); 
+    output_char(value);
 }
 
 /* SPACE [IOC.03] */
 void op_space() {
-    putchar(' ');
-    fflush(stdout);
+    output_char(' ');
 }
 
 /* SPACES [IOC.04] */
 void op_spaces(Stack *s) {
-    int count = pop(s);
+    Cell count = pop(s);
     if (count < 0) {
-        fprintf(stderr, "Invalid SPACES count: %d\n", count);
-        exit(EXIT_FAILURE);
-    }
-    for (int i = 0; i < count; i++) {
-        putchar(' ');
+        vm_throw(THROW_INVALID_ARGUMENT, "Invalid SPACES count: %" PRIdCELL "\n", count);
     }
-    fflush(stdout);
+    output_repeat(' ', (size_t)count);
 }
 
-/* TYPE [IOC.06] */
-void op_type(Stack *s, int *m) {
-    int len = pop(s);
-    int addr = pop(s);
-    if (addr < 0 || addr + len > MEMORY_SIZE) {
-        fprintf(stderr, "Invalid memory range in TYPE\n");
-        exit(EXIT_FAILURE);
+/* TYPE ( addr len -- ) -> len bytes from addr, written in one go [IOC.06] */
+void op_type(Stack *s, uint8_t *m) {
+    Cell len = pop(s);
+    Cell addr = pop(s);
+    if (addr < 0 || len < 0 || !in_memory(addr, len, (size_t)memory_cells * sizeof(Cell))) {
+        vm_throw(THROW_INVALID_ADDRESS, "Invalid memory range in TYPE\n");
     }
-    for (int i = 0; i < len; i++) {
-        int val = m[addr + i];
-        if (val < 0 || val > 255) {
-            fprintf(stderr, "Invalid character code in TYPE: %d\n", val);
-            exit(EXIT_FAILURE);
-        }
-        putchar(val);
+    output_bytes((const char *)m + addr, (size_t)len);
+}
+
+/* COUNT ( addr -- addr+1 len ) -> the text of a counted string: a length byte, then the bytes [IOC.07] */
+void op_count(Stack *s, uint8_t *m) {
+    Cell addr = pop(s);
+    if (BYTE_OUT_OF_BOUNDS(addr, memory_cells)) {
+        vm_throw(THROW_INVALID_ADDRESS, "Invalid address in COUNT\n");
     }
-    fflush(stdout);
+    push(s, addr + 1);  // Address of first char
+    push(s, m[addr]);   // Length
+}
+
+/*
+ *  STRINGS: literals are packed counted strings in the top of user memory,
+ *  below the system cells. Compiled ones are permanent and move the bottom
+ *  in STRINGS_CELL down; an interpreted S" is put just below that bottom and
+ *  lasts until the next string.
+ */
+
+/* the text after S" or .", up to the closing quote */
+static void quoted_text(const char *word, const char **text, int *length) {
+    Vm *vm = current_vm;
+    if (!vm->input || !next_text(vm->input, '"', text, length))
+        vm_throw(THROW_INVALID_ARGUMENT, "Missing \" after %s\n", word);
+    if (*length > STRING_MAX)
+        vm_throw(THROW_STRING_OVERFLOW, "String longer than %d characters\n", STRING_MAX);
 }
 
-/* COUNT [IOC.07] */
-void op_count(Stack *s, int *m) {
-    int addr = pop(s);
-    if (addr < 0 || addr >= MEMORY_SIZE) {
-        fprintf(stderr, "Invalid address in COUNT\n");
-        exit(EXIT_FAILURE);
+/* copies text into string space as a counted string; returns the address of its first byte */
+static Cell store_string(Cell *memory, const char *text, int length, bool keep) {
+    Cell bottom = strings_bottom(memory);
+    Cell at = bottom - 1 - (Cell)length;
+    if (at < 0)
+        vm_throw(THROW_DICTIONARY_OVERFLOW, "Out of memory for string literals\n");
+    uint8_t *bytes = (uint8_t *)memory;
+    bytes[at] = (uint8_t)length;
+    memcpy(bytes + at + 1, text, (size_t)length);
+    if (keep)
+        memory[STRINGS_CELL] = at;
+    return at + 1;
+}
+
+/* the built-in word for an opcode, even if the user has redefined its name since */
+static const DictEntry *builtin(Opcode opcode) {
+    const DictEntry *entry = dictionary;
+    while (entry->word && entry->opcode != opcode)
+        entry++;
+    return entry;
+}
+
+/* ." -> print the text up to ", or compile it as a literal and TYPE [IOC.05] */
+void op_dot_quote() {
+    const char *text;
+    int length;
+    quoted_text(DOTQ, &text, &length);
+    if (!is_compiling() && !is_recording()) {
+        output_bytes(text, (size_t)length);
+        return;
     }
-    int len = m[addr];
-    if (addr + 1 >= MEMORY_SIZE) {
-        fprintf(stderr, "COUNT results in out-of-bounds address\n");
-        exit(EXIT_FAILURE);
+    compile_literal(store_string(current_vm->memory.data, text, length, true));
+    compile_literal(length);
+    compile_entry(builtin(OPC_TYPE));
+}
+
+/* S" ( -- addr len ) -> the text up to ", compiled into string space inside a definition [IOC.08] */
+void op_s_quote() {
+    Vm *vm = current_vm;
+    const char *text;
+    int length;
+    quoted_text(SQUOTE, &text, &length);
+    if (!is_compiling() && !is_recording()) {
+        push(&vm->stack, store_string(vm->memory.data, text, length, false));
+        push(&vm->stack, length);
+        return;
     }
-    push(s, addr + 1);  // Address of first char
-    push(s, len);       // Length
+    compile_literal(store_string(vm->memory.data, text, length, true));
+    compile_literal(length);
 }
 
 
@@ -535,179 +685,569 @@ void op_count(Stack *s, int *m) {
  */
 
 /* . -> print and remove [ION.03] */
-void op_print(Stack *s) {
-    fprintf(stdout, "%d\n", pop(s));
+void op_print(Stack *s, Cell *m) {
+    output_number(pop(s), number_base(m));
 }
 
-/* EXIT -- pseudo command */
-void op_exit() {
-    exit(EXIT_SUCCESS);
+/* D. -> print a double number and remove it [ION.08] */
+void op_d_print(Stack *s, Cell *m) {
+    output_double(pop_double(s), number_base(m));
+}
+
+/* BASE -> address of the number conversion radix [ION.04] */
+void op_base(Stack *s, Cell *m) {
+    (void)m;
+    push(s, BASE_CELL);
+}
+
+/* DECIMAL [ION.05] */
+void op_decimal(Stack *s, Cell *m) {
+    (void)s;
+    m[BASE_CELL] = 10;
+}
+
+/* HEX [ION.06] */
+void op_hex(Stack *s, Cell *m) {
+    (void)s;
+    m[BASE_CELL] = 16;
+}
+
+/* BINARY [ION.07] */
+void op_binary(Stack *s, Cell *m) {
+    (void)s;
+    m[BASE_CELL] = 2;
+}
+
+/*
+ *  DEFINING WORDS
+ */
+
+/* : -> start a colon definition [D.01] */
+void op_colon() {
+    Token name;
+    Lexer *input = current_vm->input;
+    bool named = input && next_token(input, &name, 10);
+    if (is_compiling()) {
+        fprintf(current_vm->out, "Nested definition not allowed\n");
+        compile_abort();
+        return;
+    }
+    if (!named) {
+        fprintf(current_vm->out, "Missing name after :\n");
+        return;
+    }
+    compile_begin(name.start, name.length);
+}
+
+/* ; -> end a colon definition [D.02] */
+void op_semicolon() {
+    if (!is_compiling()) {
+        fprintf(current_vm->out, "; without :\n");
+        return;
+    }
+    compile_end();
+}
+
+/* ' -> execution token of the next word; inside a definition it is compiled as a literal [D.03] */
+void op_tick() {
+    Vm *vm = current_vm;
+    Token name;
+    if (!vm->input || !next_token(vm->input, &name, 10))
+        vm_throw(THROW_UNDEFINED_WORD, "Missing name after '\n");
+    DictEntry *entry = find_token(&name);
+    if (!entry)
+        vm_throw(THROW_UNDEFINED_WORD, "Unknown word: %.*s\n", name.length, name.start);
+
+    int xt = vm_xt(vm, entry);
+    if (is_compiling() || is_recording())
+        compile_literal(xt);
+    else
+        push(&vm->stack, xt);
+}
+
+/*
+ *  CONTROL FLOW: compile-only, the branches are resolved as the definition is compiled
+ */
+
+/* IF ( flag -- ) -> run the true part only when flag is non-zero [F.01] */
+void op_if() {
+    compile_control(CONTROL_IF);
+}
+
+/* ELSE -> the part run when the IF flag was zero [F.02] */
+void op_else() {
+    compile_control(CONTROL_ELSE);
+}
+
+/* THEN -> end of IF ... ELSE [F.03] */
+void op_then() {
+    compile_control(CONTROL_THEN);
+}
+
+/* BEGIN -> start of a loop [F.04] */
+void op_begin() {
+    compile_control(CONTROL_BEGIN);
+}
+
+/* UNTIL ( flag -- ) -> back to BEGIN until flag is non-zero [F.05] */
+void op_until() {
+    compile_control(CONTROL_UNTIL);
+}
+
+/* WHILE ( flag -- ) -> leave a BEGIN ... REPEAT loop when flag is zero [F.06] */
+void op_while() {
+    compile_control(CONTROL_WHILE);
+}
+
+/* REPEAT -> back to BEGIN [F.07] */
+void op_repeat() {
+    compile_control(CONTROL_REPEAT);
+}
+
+/* AGAIN -> back to BEGIN, unconditionally [F.08] */
+void op_again() {
+    compile_control(CONTROL_AGAIN);
+}
+
+/* DO ( limit index -- ) -> start a counted loop [F.09] */
+void op_do() {
+    compile_control(CONTROL_DO);
+}
+
+/* LOOP -> add 1 to the index, back to DO while it is below the limit [F.10] */
+void op_loop() {
+    compile_control(CONTROL_LOOP);
+}
+
+/* +LOOP ( n -- ) -> add n to the index, back to DO until it crosses the limit [F.11] */
+void op_plus_loop() {
+    compile_control(CONTROL_PLUS_LOOP);
+}
+
+/* I ( -- n ) -> index of the innermost loop [F.12] */
+void op_i() {
+    compile_control(CONTROL_I);
+}
+
+/* J ( -- n ) -> index of the loop around it [F.13] */
+void op_j() {
+    compile_control(CONTROL_J);
+}
+
+/* LEAVE -> set the limit to the index, ending the loop at LOOP or +LOOP [F.14] */
+void op_leave() {
+    compile_control(CONTROL_LEAVE);
+}
+
+/*
+ *  EXECUTION
+ */
+
+/* EXECUTE ( xt -- ) [X.01] */
+void op_execute(Stack *s, Stack *rs) {
+    Vm *vm = current_vm;
+    const DictEntry *entry = vm_xt_entry(vm, pop(s));
+    execute(entry, s, rs, vm->memory.data);
+}
+
+/* CATCH ( xt -- 0 | code ) -> run xt; a THROW inside it returns here with the stack depths restored [X.02] */
+void op_catch(Stack *s, Stack *rs) {
+    Vm *vm = current_vm;
+    const DictEntry *entry = vm_xt_entry(vm, pop(s));
+    CatchFrame frame;
+
+    frame.depth = s->top;
+    frame.return_depth = rs->top;
+    frame.outer = vm->catch_frame;
+    frame.profile_frame = vm->profile ? vm->profile->frame : NULL;
+    vm->catch_frame = &frame;
+    int code = setjmp(frame.jump);
+    if (code == 0) {
+        execute(entry, s, rs, vm->memory.data);
+    } else {
+        s->top = frame.depth;
+        rs->top = frame.return_depth;
+        if (vm->profile)
+            profile_unwind(vm->profile, frame.profile_frame);
+    }
+    vm->catch_frame = frame.outer;
+    push(s, code);
+}
+
+/* THROW ( code -- ) -> 0 does nothing, anything else unwinds to the innermost CATCH [X.03] */
+void op_throw(Stack *s) {
+    Cell code = pop(s);
+    if (code != 0)
+        vm_throw(code, NULL);
+}
+
+/* PAR-MAP ( addr n xt -- ) -> replace each cell x with xt ( x -- y ), on all cores, see Par.c [X.04] */
+void op_par_map(Stack *s) {
+    Vm *vm = current_vm;
+    const DictEntry *entry = vm_xt_entry(vm, pop(s));
+    Cell n = pop(s);
+    Cell addr = pop(s);
+    check_cells(addr, n, false, PARMAP);
+    par_map(vm, entry, addr, n);
+}
+
+/* PAR-REDUCE ( addr n xt init -- r ) -> fold the cells with xt ( a b -- c ), on all cores [X.05] */
+void op_par_reduce(Stack *s, Stack *rs) {
+    Vm *vm = current_vm;
+    Cell init = pop(s);
+    const DictEntry *entry = vm_xt_entry(vm, pop(s));
+    Cell n = pop(s);
+    Cell addr = pop(s);
+    check_cells(addr, n, false, PARREDUCE);
+    push(s, par_reduce(vm, entry, s, rs, addr, n, init));
+}
+
+/*
+ *  TOOLS
+ */
+
+/* .FUSIONS -> peephole rewrites applied so far [T.01] */
+void op_fusions() {
+    peephole_report(current_vm->out);
+}
+
+/* FLUSH -> write buffered output now [T.02] */
+void op_flush() {
+    output_flush();
+}
+
+/* PROFILE-ON -> start charging time and executions to each word and call path [T.03] */
+void op_profile_on() {
+#ifdef YAFI_PROFILE
+    Vm *vm = current_vm;
+    if (!vm->profile)
+        vm->profile = profile_create();
+    if (!vm->profile->on)
+        profile_start(vm->profile);
+#else
+    fprintf(stderr, "PROFILE-ON: profiling is not built in, rebuild with make PROFILE=yes\n");
+#endif
 }
 
-void to_uppercase(char *str) {
-    for (; *str; ++str) 
-        *str = toupper(*str);
+/* PROFILE-OFF -> stop profiling; what was counted is kept [T.04] */
+void op_profile_off() {
+    Vm *vm = current_vm;
+    if (vm->profile && vm->profile->on)
+        profile_stop(vm->profile);
 }
 
-bool is_number(const char *token) {
-    if (*token == '-' || *token == '+') 
-        token++;
-    if (!*token) 
+/* PROFILE-DUMP -> write the profile as folded stacks, see Profile.c [T.05] */
+void op_profile_dump() {
+    Vm *vm = current_vm;
+    if (!vm->profile) {
+        fprintf(stderr, "PROFILE-DUMP: nothing profiled\n");
+        return;
+    }
+    output_flush();
+    if (profile_write(vm->profile, vm->profile_path))
+        fprintf(stderr, "Profile written to %s and %s.calls\n", vm->profile_path, vm->profile_path);
+}
+
+/* the file name after SAVE-IMAGE or LOAD-IMAGE; false, with the reason printed, when it cannot run */
+static bool image_path(const char *word, char *path, size_t size) {
+    Vm *vm = current_vm;
+    Token name;
+    if (!vm->input || !next_token(vm->input, &name, 10))
+        vm_throw(THROW_FILE_IO, "Missing file name after %s\n", word);
+    if (is_compiling()) {
+        fprintf(vm->out, "%s inside a definition\n", word);
+        compile_abort();
         return false;
-    while (*token) {
-        if (!isdigit(*token)) 
-            return false;
-        token++;
     }
+    if (is_recording())
+        vm_throw(THROW_UNSUPPORTED, "%s is not available in yafi-aot\n", word);
+    if ((size_t)name.length >= size)
+        vm_throw(THROW_FILE_IO, "File name too long after %s\n", word);
+    memcpy(path, name.start, (size_t)name.length);
+    path[name.length] = '\0';
     return true;
 }
 
+/* SAVE-IMAGE name -> words, stacks and memory to a file, see Image.c [T.06] */
+void op_save_image() {
+    char path[FILENAME_MAX];
+    if (image_path(SAVEIMG, path, sizeof(path)))
+        image_save(current_vm, path);
+}
+
+/* LOAD-IMAGE name -> replace the words, stacks and memory with a saved image; only from the interpreter [T.07] */
+void op_load_image() {
+    char path[FILENAME_MAX];
+    if (image_path(LOADIMG, path, sizeof(path)))
+        image_load(current_vm, path);
+}
+
+/*
+ *  TASKS: cooperative, each with its own stacks and user area, see Task.c
+ */
+
+/* SPAWN ( x xt -- ) -> a new task running xt, with x on its stack [K.01] */
+void op_spawn(Stack *s) {
+    Vm *vm = current_vm;
+    const DictEntry *entry = vm_xt_entry(vm, pop(s));
+    task_spawn(vm, entry, pop(s));
+}
+
+/* PAUSE -> let every other task run until it pauses [K.02] */
+void op_pause() {
+    task_pause(current_vm);
+}
+
+/* STOP -> end the running task [K.03] */
+void op_stop() {
+    task_stop(current_vm);
+}
+
+/* TASKS ( -- n ) -> tasks that have not ended [K.04] */
+void op_tasks(Stack *s) {
+    push(s, current_vm->tasks.live);
+}
+
+/* USER-AREA ( -- addr ) -> USER_CELLS cells of the running task's own, zeroed when it starts [K.05] */
+void op_user_area(Stack *s) {
+    push(s, task_user_area(current_vm));
+}
+
+/* EXIT -- pseudo command */
+void op_exit() {
+    vm_stop(EXIT_SUCCESS);
+}
+
+/* a BASE outside 2..36 converts as DECIMAL rather than failing every number */
+int number_base(const Cell *memory) {
+    Cell base = memory[BASE_CELL];
+    return (base >= 2 && base <= 36) ? (int)base : 10;
+}
+
+/* the bottom of string space, checked: STRINGS_CELL is a cell any program can store to */
+Cell strings_bottom(const Cell *memory) {
+    size_t top = (size_t)STRINGS_CELL * sizeof(Cell);
+    Cell bottom = memory[STRINGS_CELL];
+    if (bottom < 0 || (size_t)bottom > top)
+        vm_throw(THROW_INVALID_ADDRESS, "Invalid string space bottom %" PRIdCELL "\n", bottom);
+    return bottom;
+}
+
+/* memory arrives zeroed; only the system cells need values */
+void init_memory(Cell *memory) {
+    size_t top = (size_t)STRINGS_CELL * sizeof(Cell);
+    memory[BASE_CELL] = 10;
+    memory[STRINGS_CELL] = (top < (size_t)CELL_MAX) ? (Cell)top : CELL_MAX;
+}
+
 DictEntry dictionary[] = {
 /* COMPUTATION */
-/* [C.01] */     {       LT, OP_0, {.fp_s       = op_less_than      } }, 
-/* [C.02] */     {       EQ, OP_0, {.fp_s       = op_equal          } }, 
-/* [C.03] */     {       GT, OP_0, {.fp_s       = op_greater_than   } }, 
-/* [C.04] */     {      NEG, OP_0, {.fp_s       = op_zero_less      } },
-/* [C.05] */     {     ZERO, OP_0, {.fp_s       = op_zero_equal     } },
-/* [C.06] */     {      POS, OP_0, {.fp_s       = op_zero_greater   } },
-/* [C.09] */     {      NOT, OP_0, {.fp_s       = op_not            } },
-/* [IOC.01] */   {       CR, OP,   {.fp         = op_cr             } },
+/* [C.01] */     {       LT, OP_0, {.fp_s       = op_less_than      }, OPC_LESS_THAN,    2, 1 }, 
+/* [C.02] */     {       EQ, OP_0, {.fp_s       = op_equal          }, OPC_EQUAL,        2, 1 }, 
+/* [C.03] */     {       GT, OP_0, {.fp_s       = op_greater_than   }, OPC_GREATER_THAN, 2, 1 }, 
+/* [C.04] */     {      NEG, OP_0, {.fp_s       = op_zero_less      }, OPC_ZERO_LESS,    1, 1 },
+/* [C.05] */     {     ZERO, OP_0, {.fp_s       = op_zero_equal     }, OPC_ZERO_EQUAL,   1, 1 },
+/* [C.06] */     {      POS, OP_0, {.fp_s       = op_zero_greater   }, OPC_ZERO_GREATER, 1, 1 },
+/* [C.07] */     {    DLESS, OP_0, {.fp_s       = op_d_less         }, OPC_D_LESS,       4, 1 },
+/* [C.09] */     {      NOT, OP_0, {.fp_s       = op_not            }, OPC_NOT,          1, 1 },
+/* [IOC.01] */   {       CR, OP,   {.fp         = op_cr             }, OPC_CR,           0, 0 },
 
 /* IO-CHARACTERS */
-/* [IOC.02] */   {     EMIT, OP_0, {.fp_s       = op_emit           } },
-/* [IOC.03] */   {    SPACE, OP,   {.fp         = op_space          } },
-/* [IOC.04] */   {   SPACES, OP_0, {.fp_s       = op_spaces         } },
-/* [IOC.06] */   {     TYPE, OP_2, {.fp_s_m     = op_type           } },
-/* [IOC.07] */   {    COUNT, OP_2, {.fp_s_m     = op_count          } },
+/* [IOC.02] */   {     EMIT, OP_0, {.fp_s       = op_emit           }, OPC_EMIT,         1, 0 },
+/* [IOC.03] */   {    SPACE, OP,   {.fp         = op_space          }, OPC_SPACE,        0, 0 },
+/* [IOC.04] */   {   SPACES, OP_0, {.fp_s       = op_spaces         }, OPC_SPACES,       1, 0 },
+/* [IOC.05] */   {     DOTQ, OP_COMPILER, {.fp  = op_dot_quote      }, OPC_DOT_QUOTE,    0, 0 },
+/* [IOC.06] */   {     TYPE, OP_3, {.fp_s_bm    = op_type           }, OPC_TYPE,         2, 0 },
+/* [IOC.07] */   {    COUNT, OP_3, {.fp_s_bm    = op_count          }, OPC_COUNT,        1, 2 },
+/* [IOC.08] */   {   SQUOTE, OP_COMPILER, {.fp  = op_s_quote        }, OPC_S_QUOTE,      0, 2 },
 
 /* LOGICAL */
-/* [L.01] */     {      ADD, OP_0, {.fp_s       = op_add            } },
-/* [L.02] */     {      SUB, OP_0, {.fp_s       = op_sub            } },
-/* [L.03] */     {      MUL, OP_0, {.fp_s       = op_mul            } },
-/* [L.04] */     {      DIV, OP_0, {.fp_s       = op_div            } },
-/* [L.05] */     {      MOD, OP_0, {.fp_s       = op_mod            } },
-/* [L.06] */     {   DIVMOD, OP_0, {.fp_s       = op_divmod         } },
-/* [L.07] */     { ONE_PLUS, OP_0, {.fp_s       = op_one_plus       } },
-/* [L.08] */     {  ONE_MIN, OP_0, {.fp_s       = op_one_minus      } },
-/* [L.09] */     { TWO_PLUS, OP_0, {.fp_s       = op_two_plus       } },
-/* [L.10] */     {  TWO_MIN, OP_0, {.fp_s       = op_two_minus      } },
-/* [L.11] */     {    DPLUS, OP_0, {.fp_s       = op_d_plus         } },
-/* [L.16] */     {      MAX, OP_0, {.fp_s       = op_max            } },
-/* [L.17] */     {      MIN, OP_0, {.fp_s       = op_min            } },
-/* [L.18] */     {      ABS, OP_0, {.fp_s       = op_abs            } },
-/* [L.19] */     {   NEGATE, OP_0, {.fp_s       = op_negate         } },
-/* [L.20] */     {  DNEGATE, OP_0, {.fp_s       = op_dnegate        } },
-/* [L.21] */     {      AND, OP_0, {.fp_s       = op_and            } },
-/* [L.22] */     {       OR, OP_0, {.fp_s       = op_or             } },
-/* [L.23] */     {      XOR, OP_0, {.fp_s       = op_xor            } },
+/* [L.01] */     {      ADD, OP_0, {.fp_s       = op_add            }, OPC_ADD,          2, 1 },
+/* [L.02] */     {      SUB, OP_0, {.fp_s       = op_sub            }, OPC_SUB,          2, 1 },
+/* [L.03] */     {      MUL, OP_0, {.fp_s       = op_mul            }, OPC_MUL,          2, 1 },
+/* [L.04] */     {      DIV, OP_0, {.fp_s       = op_div            }, OPC_DIV,          2, 1 },
+/* [L.05] */     {      MOD, OP_0, {.fp_s       = op_mod            }, OPC_MOD,          2, 1 },
+/* [L.06] */     {   DIVMOD, OP_0, {.fp_s       = op_divmod         }, OPC_DIVMOD,       2, 2 },
+/* [L.07] */     { ONE_PLUS, OP_0, {.fp_s       = op_one_plus       }, OPC_ONE_PLUS,     1, 1 },
+/* [L.08] */     {  ONE_MIN, OP_0, {.fp_s       = op_one_minus      }, OPC_ONE_MINUS,    1, 1 },
+/* [L.09] */     { TWO_PLUS, OP_0, {.fp_s       = op_two_plus       }, OPC_TWO_PLUS,     1, 1 },
+/* [L.10] */     {  TWO_MIN, OP_0, {.fp_s       = op_two_minus      }, OPC_TWO_MINUS,    1, 1 },
+/* [L.11] */     {    DPLUS, OP_0, {.fp_s       = op_d_plus         }, OPC_D_PLUS,       4, 2 },
+/* [L.12] */     {    MSTAR, OP_0, {.fp_s       = op_m_star         }, OPC_M_STAR,       2, 2 },
+/* [L.13] */     {   UMSTAR, OP_0, {.fp_s       = op_um_star        }, OPC_UM_STAR,      2, 2 },
+/* [L.14] */     {   UMSMOD, OP_0, {.fp_s       = op_um_slash_mod   }, OPC_UM_SLASH_MOD, 3, 2 },
+/* [L.15] */     {   SSLASH, OP_0, {.fp_s       = op_star_slash     }, OPC_STAR_SLASH,   3, 1 },
+/* [L.16] */     {      MAX, OP_0, {.fp_s       = op_max            }, OPC_MAX,          2, 1 },
+/* [L.17] */     {      MIN, OP_0, {.fp_s       = op_min            }, OPC_MIN,          2, 1 },
+/* [L.18] */     {      ABS, OP_0, {.fp_s       = op_abs            }, OPC_ABS,          1, 1 },
+/* [L.19] */     {   NEGATE, OP_0, {.fp_s       = op_negate         }, OPC_NEGATE,       1, 1 },
+/* [L.20] */     {  DNEGATE, OP_0, {.fp_s       = op_dnegate        }, OPC_DNEGATE,      2, 2 },
+/* [L.21] */     {      AND, OP_0, {.fp_s       = op_and            }, OPC_AND,          2, 1 },
+/* [L.22] */     {       OR, OP_0, {.fp_s       = op_or             }, OPC_OR,           2, 1 },
+/* [L.23] */     {      XOR, OP_0, {.fp_s       = op_xor            }, OPC_XOR,          2, 1 },
+/* [L.24] */     {SSLASHMOD, OP_0, {.fp_s       = op_star_slash_mod }, OPC_STAR_SLASH_MOD, 3, 2 },
 
 /* MEMORY */
-/* [M.01] */     {    FETCH, OP_2, {.fp_s_m     = op_fetch          } },
-/* [M.02] */     {    STORE, OP_2, {.fp_s_m     = op_store          } },
-/* [M.03] */     {   CFETCH, OP_3, {.fp_s_bm    = op_cfetch         } },
-/* [M.04] */     {   CSTORE, OP_3, {.fp_s_bm    = op_cstore         } },
-/* [M.05] */     { QUESTION, OP_2, {.fp_s_m     = op_question       } },
-/* [M.07] */     {     MOVE, OP_3, {.fp_s_bm    = op_move           } },
-/* [M.08] */     {    CMOVE, OP_3, {.fp_s_bm    = op_cmove          } },
-/* [M.09] */     {     FILL, OP_3, {.fp_s_bm    = op_fill           } },
+/* [M.01] */     {    FETCH, OP_2, {.fp_s_m     = op_fetch          }, OPC_FETCH,        1, 1 },
+/* [M.02] */     {    STORE, OP_2, {.fp_s_m     = op_store          }, OPC_STORE,        2, 0 },
+/* [M.03] */     {   CFETCH, OP_3, {.fp_s_bm    = op_cfetch         }, OPC_CFETCH,       1, 1 },
+/* [M.04] */     {   CSTORE, OP_3, {.fp_s_bm    = op_cstore         }, OPC_CSTORE,       2, 0 },
+/* [M.05] */     { QUESTION, OP_2, {.fp_s_m     = op_question       }, OPC_QUESTION,     1, 0 },
+/* [M.07] */     {     MOVE, OP_3, {.fp_s_bm    = op_move           }, OPC_MOVE,         3, 0 },
+/* [M.08] */     {    CMOVE, OP_3, {.fp_s_bm    = op_cmove          }, OPC_CMOVE,        3, 0 },
+/* [M.09] */     {     FILL, OP_3, {.fp_s_bm    = op_fill           }, OPC_FILL,         3, 0 },
+/* [M.10] */     {     CSUM, OP_2, {.fp_s_m     = op_cells_sum      }, OPC_CELLS_SUM,    2, 1 },
+/* [M.11] */     {     CMIN, OP_2, {.fp_s_m     = op_cells_min      }, OPC_CELLS_MIN,    2, 1 },
+/* [M.12] */     {     CMAX, OP_2, {.fp_s_m     = op_cells_max      }, OPC_CELLS_MAX,    2, 1 },
+/* [M.13] */     {     CCMP, OP_2, {.fp_s_m     = op_cells_compare  }, OPC_CELLS_COMPARE, 3, 1 },
+/* [M.14] */     {    CFIND, OP_2, {.fp_s_m     = op_cells_search   }, OPC_CELLS_SEARCH, 3, 1 },
 
 /* STACK */
-/* [S.01] */     {      DUP, OP_0, {.fp_s       = op_dup            } },
-/* [S.02] */     {     DROP, OP_0, {.fp_s       = op_drop           } },
-/* [S.03] */     {     SWAP, OP_0, {.fp_s       = op_swap           } },
-/* [S.04] */     {     OVER, OP_0, {.fp_s       = op_over           } },
-/* [S.05] */     {      ROT, OP_0, {.fp_s       = op_rot            } },
-/* [S.06] */     {     PICK, OP_0, {.fp_s       = op_pick           } },
-/* [S.07] */     {     ROLL, OP_0, {.fp_s       = op_roll           } },
-/* [S.09] */     {    DEPTH, OP_0, {.fp_s       = op_depth          } },
-/* [S.10] */     {      TOR, OP_1, {.fp_s_rs    = op_to_r           } },
-/* [S.11] */     {    RFROM, OP_1, {.fp_s_rs    = op_r_from         } },
-/* [S.12] */     {   RFETCH, OP_1, {.fp_s_rs    = op_r_fetch        } },
+/* [S.01] */     {      DUP, OP_0, {.fp_s       = op_dup            }, OPC_DUP,          1, 2 },
+/* [S.02] */     {     DROP, OP_0, {.fp_s       = op_drop           }, OPC_DROP,         1, 0 },
+/* [S.03] */     {     SWAP, OP_0, {.fp_s       = op_swap           }, OPC_SWAP,         2, 2 },
+/* [S.04] */     {     OVER, OP_0, {.fp_s       = op_over           }, OPC_OVER,         2, 3 },
+/* [S.05] */     {      ROT, OP_0, {.fp_s       = op_rot            }, OPC_ROT,          3, 3 },
+/* [S.06] */     {     PICK, OP_0, {.fp_s       = op_pick           }, OPC_PICK,         1, 1 },
+/* [S.07] */     {     ROLL, OP_0, {.fp_s       = op_roll           }, OPC_ROLL,         1, 0 },
+/* [S.09] */     {    DEPTH, OP_0, {.fp_s       = op_depth          }, OPC_DEPTH,        0, 1 },
+/* [S.10] */     {      TOR, OP_1, {.fp_s_rs    = op_to_r           }, OPC_TO_R,         1, 0 },
+/* [S.11] */     {    RFROM, OP_1, {.fp_s_rs    = op_r_from         }, OPC_R_FROM,       0, 1 },
+/* [S.12] */     {   RFETCH, OP_1, {.fp_s_rs    = op_r_fetch        }, OPC_R_FETCH,      0, 1 },
 
 /* IO-NUMBERS */
-/* [ION.03] */   {    PRINT, OP_0, {.fp_s       = op_print          } },
+/* [ION.03] */   {    PRINT, OP_2, {.fp_s_m     = op_print          }, OPC_PRINT,        1, 0 },
+/* [ION.08] */   {   DPRINT, OP_2, {.fp_s_m     = op_d_print        }, OPC_D_PRINT,      2, 0 },
+/* [ION.04] */   {     BASE, OP_2, {.fp_s_m     = op_base           }, OPC_BASE,         0, 1 },
+/* [ION.05] */   {  DECIMAL, OP_2, {.fp_s_m     = op_decimal        }, OPC_DECIMAL,      0, 0 },
+/* [ION.06] */   {      HEX, OP_2, {.fp_s_m     = op_hex            }, OPC_HEX,          0, 0 },
+/* [ION.07] */   {      BIN, OP_2, {.fp_s_m     = op_binary         }, OPC_BINARY,       0, 0 },
+
+/* DEFINING */
+/* [D.01] */     {    COLON, OP_COMPILER, {.fp  = op_colon          }, OPC_COLON,        0, 0 },
+/* [D.02] */     {SEMICOLON, OP_COMPILER, {.fp  = op_semicolon      }, OPC_SEMICOLON,    0, 0 },
+/* [D.03] */     {     TICK, OP_COMPILER, {.fp  = op_tick           }, OPC_TICK,         0, 1 },
+
+/* CONTROL FLOW */
+/* [F.01] */     {       IF, OP_COMPILER, {.fp  = op_if             }, OPC_CONTROL,      0, 0 },
+/* [F.02] */     {     ELSE, OP_COMPILER, {.fp  = op_else           }, OPC_CONTROL,      0, 0 },
+/* [F.03] */     {     THEN, OP_COMPILER, {.fp  = op_then           }, OPC_CONTROL,      0, 0 },
+/* [F.04] */     {    BEGIN, OP_COMPILER, {.fp  = op_begin          }, OPC_CONTROL,      0, 0 },
+/* [F.05] */     {    UNTIL, OP_COMPILER, {.fp  = op_until          }, OPC_CONTROL,      0, 0 },
+/* [F.06] */     {    WHILE, OP_COMPILER, {.fp  = op_while          }, OPC_CONTROL,      0, 0 },
+/* [F.07] */     {   REPEAT, OP_COMPILER, {.fp  = op_repeat         }, OPC_CONTROL,      0, 0 },
+/* [F.08] */     {    AGAIN, OP_COMPILER, {.fp  = op_again          }, OPC_CONTROL,      0, 0 },
+/* [F.09] */     {       DO, OP_COMPILER, {.fp  = op_do             }, OPC_CONTROL,      0, 0 },
+/* [F.10] */     {     LOOP, OP_COMPILER, {.fp  = op_loop           }, OPC_CONTROL,      0, 0 },
+/* [F.11] */     {    PLOOP, OP_COMPILER, {.fp  = op_plus_loop      }, OPC_CONTROL,      0, 0 },
+/* [F.12] */     {  INDEX_I, OP_COMPILER, {.fp  = op_i              }, OPC_CONTROL,      0, 0 },
+/* [F.13] */     {  INDEX_J, OP_COMPILER, {.fp  = op_j              }, OPC_CONTROL,      0, 0 },
+/* [F.14] */     {    LEAVE, OP_COMPILER, {.fp  = op_leave          }, OPC_CONTROL,      0, 0 },
+
+/* EXECUTION */
+/* [X.01] */     {  EXECUTE, OP_1, {.fp_s_rs    = op_execute        }, OPC_EXECUTE,      1, 0 },
+/* [X.02] */     {    CATCH, OP_1, {.fp_s_rs    = op_catch          }, OPC_CATCH,        1, 1 },
+/* [X.03] */     {    THROW, OP_0, {.fp_s       = op_throw          }, OPC_THROW,        1, 0 },
+/* [X.04] */     {   PARMAP, OP_0, {.fp_s       = op_par_map        }, OPC_PAR_MAP,      3, 0 },
+/* [X.05] */     {PARREDUCE, OP_1, {.fp_s_rs    = op_par_reduce     }, OPC_PAR_REDUCE,   4, 1 },
+
+/* TOOLS */
+/* [T.01] */     {  FUSIONS, OP,   {.fp         = op_fusions        }, OPC_FUSIONS,      0, 0 },
+/* [T.02] */     {    FLUSH, OP,   {.fp         = op_flush          }, OPC_FLUSH,        0, 0 },
+/* [T.03] */     {      PON, OP,   {.fp         = op_profile_on     }, OPC_PROFILE_ON,   0, 0 },
+/* [T.04] */     {     POFF, OP,   {.fp         = op_profile_off    }, OPC_PROFILE_OFF,  0, 0 },
+/* [T.05] */     {    PDUMP, OP,   {.fp         = op_profile_dump   }, OPC_PROFILE_DUMP, 0, 0 },
+/* [T.06] */     {  SAVEIMG, OP_COMPILER, {.fp  = op_save_image     }, OPC_SAVE_IMAGE,   0, 0 },
+/* [T.07] */     {  LOADIMG, OP_COMPILER, {.fp  = op_load_image     }, OPC_LOAD_IMAGE,   0, 0 },
+
+/* TASKS */
+/* [K.01] */     {    SPAWN, OP_0, {.fp_s       = op_spawn          }, OPC_SPAWN,        2, 0 },
+/* [K.02] */     {    PAUSE, OP,   {.fp         = op_pause          }, OPC_PAUSE,        0, 0 },
+/* [K.03] */     {     STOP, OP,   {.fp         = op_stop           }, OPC_STOP,         0, 0 },
+/* [K.04] */     {    TASKS, OP_0, {.fp_s       = op_tasks          }, OPC_TASKS,        0, 1 },
+/* [K.05] */     { USERAREA, OP_0, {.fp_s       = op_user_area      }, OPC_USER_AREA,    0, 1 },
 
 /* PSEUDO */
-/* PSEUDO */     {     EXIT, OP,   {.fp         = op_exit           } },
-/* SENTINEL */   {     NULL, OP_0, {NULL                            } }
+/* PSEUDO */     {     EXIT, OP,   {.fp         = op_exit           }, OPC_EXIT,         0, 0 },
+/* SENTINEL */   {     NULL, OP_0, {NULL                            }, OPC_RET,          0, 0 }
 };   
  
-DictEntry *find_entry(const char *word) {
-    for (int i = 0; dictionary[i].word != NULL; i++) {
-        if (strcmp(dictionary[i].word, word) == 0) {
-            return &dictionary[i];
-        }
-    }
-    return NULL;
-}
-
-void interpret(Stack *stack, Stack *return_stack, int *memory, char *line) {
-    char *token = strtok(line, " \t\r\n");
-    while (token != NULL) {
-        to_uppercase(token);
-
-        DictEntry *entry = find_entry(token);
-        if (entry) {
-            switch (entry->type) {
-                case OP:
-                    if (entry->func.fp) entry->func.fp(); 
-                    break;
-                case OP_0:
-                    if (entry->func.fp_s) entry->func.fp_s(stack); 
-                    break;
-                case OP_1:
-                    if (entry->func.fp_s_rs) entry->func.fp_s_rs(stack, return_stack);
-                    break;
-                case OP_2:
-                    if (entry->func.fp_s_m) entry->func.fp_s_m(stack, memory);                    
-                    break;
-                case OP_3:
-                     if (entry->func.fp_s_bm) entry->func.fp_s_bm(stack, (uint8_t *)memory);                    
-                    break;               
-                default:
-                    fprintf(stdout, "Unknown op type\n");
-                    exit(EXIT_FAILURE);
-                    break;
-            }
-        } else if (is_number(token)) {
-            push(stack, atoi(token));
-        } else {
-            fprintf(stdout, "Unknown word: %s\n", token);
-        }
-
-        token = strtok(NULL, " \t\r\n");
+void execute_primitive(const DictEntry *entry, Stack *stack, Stack *return_stack, Cell *memory) {
+    switch (entry->type) {
+        case OP_COMPILER:
+            /* the interpreter calls it directly; running code has the old memory in hand */
+            if (entry->opcode == OPC_LOAD_IMAGE)
+                vm_throw(THROW_UNSUPPORTED, "LOAD-IMAGE only runs from the interpreter\n");
+            /* fall through */
+        case OP:
+            if (entry->func.fp) entry->func.fp(); 
+            break;
+        case OP_0:
+            if (entry->func.fp_s) entry->func.fp_s(stack); 
+            break;
+        case OP_1:
+            if (entry->func.fp_s_rs) entry->func.fp_s_rs(stack, return_stack);
+            break;
+        case OP_2:
+            if (entry->func.fp_s_m) entry->func.fp_s_m(stack, memory);                    
+            break;
+        case OP_3:
+             if (entry->func.fp_s_bm) entry->func.fp_s_bm(stack, (uint8_t *)memory);                    
+            break;               
+        default:
+            vm_throw(THROW_UNSUPPORTED, "Unknown op type\n");
+            break;
     }
 }
 
+/* BASE only changes how literals convert, so yafi-aot applies it while recording too */
+static bool sets_base(const DictEntry *entry) {
+    return entry->opcode == OPC_DECIMAL || entry->opcode == OPC_HEX || entry->opcode == OPC_BINARY;
+}
 
-/*
- *  Main
- */
-int main() {
-    Stack stack;
-    Stack return_stack;
-    int memory[MEMORY_SIZE];
-    char line[LINE_SIZE + 1];
-
-    init_stack(&stack);
-    init_stack(&return_stack);
-
-    fprintf(stdout, BANNER_YAFI);
-    fprintf(stdout, BANNER_AUTHOR);
-    fprintf(stdout, BANNER_HELP);
-
-    while (true) {
-        fprintf(stdout, "> ");
-        if (!fgets(line, LINE_SIZE, stdin)) 
-            break;
-        interpret(&stack, &return_stack, memory, line);
-
-        fprintf(stdout, "\nStack: ");
-        for (int i = 0; i < stack.top; i++) {
-            fprintf(stdout, "%d ", stack.data[i]);
+bool interpret_text(Vm *vm, const char *text, size_t length) {
+    Stack *stack = &vm->stack;
+    Stack *return_stack = &vm->return_stack;
+    Cell *memory = vm->memory.data;
+    bool ok = true;
+    Lexer lexer;
+    Lexer *outer = vm->input;
+    Token token;
+
+    vm_enter(vm);
+    lexer_begin(&lexer, text, length);
+    vm->input = &lexer;
+    while (next_token(&lexer, &token, number_base(memory))) {
+        DictEntry *entry = find_token(&token);
+        if (entry && entry->type == OP_COMPILER) {
+            entry->func.fp();
+            memory = vm->memory.data;   /* LOAD-IMAGE brings its own */
+        } else if (is_compiling() || is_recording()) {
+            if (entry) {
+                compile_entry(entry);
+                if (!is_compiling() && sets_base(entry))
+                    execute(entry, stack, return_stack, memory);
+            } else if (token.is_number) {
+                compile_literal(token.value);
+            } else {
+                fprintf(current_vm->out, "Unknown word: %.*s\n", token.length, token.start);
+                ok = false;
+                if (is_compiling())
+                    compile_abort();
+            }
+        } else if (entry) {
+            execute(entry, stack, return_stack, memory);
+        } else if (token.is_number) {
+            push(stack, token.value);
+        } else {
+            fprintf(current_vm->out, "Unknown word: %.*s\n", token.length, token.start);
+            ok = false;
         }
-        fprintf(stdout, "\n");
     }
+    vm->input = outer;
+    return ok;
+}
 
-    return EXIT_SUCCESS;
+bool interpret(Vm *vm, char *line) {
+    return interpret_text(vm, line, strlen(line));
 }
@@ -7,8 +7,8 @@
  * Author:          Diederick
  * Created:         2025-06-04
  * License:         MIT
- * Remarks:         beware that a memory cell is 32-bits. 
- *                  The memory model is based on a array of int
+ * Remarks:         a memory cell is a Cell, 32 bits unless built with
+ *                  make CELL=64 (see Cell.h). The memory model is an array of cells.
  *                  Beware, some memory operations are byte oriented (verbs with C)
  */
 
@@ -17,26 +17,99 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "Stack.h"
 
-#define LINE_SIZE 256
+/* default cells of VM memory; memory_cells is the size of the VM running on this thread */
 #define MEMORY_SIZE 16384
+extern _Thread_local int memory_cells;
+
+/*
+ * system cells at the top of memory, above the user's: the radix used by
+ * number conversion and ., and the lowest byte of the string literals,
+ * which are packed into the top of user memory and grow down from here
+ */
+#define SYSTEM_CELLS 2
+#define BASE_CELL   (memory_cells - 1)
+#define STRINGS_CELL (memory_cells - 2)
+
+/* the longest string literal: its length has to fit the count byte */
+#define STRING_MAX  255
+
+/*
+ * Single-cell and byte accesses test their address here. With YAFI_GUARDED_MEMORY
+ * (make GUARD=yes) memory lies inside PROT_NONE guard regions big enough
+ * for any 32-bit address, so a stray access traps and the test goes away.
+ */
+#ifdef YAFI_GUARDED_MEMORY
+#ifdef YAFI_CELL_64
+#error "GUARD=yes needs 32-bit cells: no guard region covers a 64-bit address"
+#endif
+#define OUT_OF_BOUNDS(addr, cells)  ((void)(cells), false)
+#define BYTE_OUT_OF_BOUNDS(addr, cells)  ((void)(cells), false)
+#else
+#define OUT_OF_BOUNDS(addr, cells)  ((UCell)(addr) >= (UCell)(cells))
+#define BYTE_OUT_OF_BOUNDS(addr, cells)  ((UCell)(addr) >= (size_t)(cells) * sizeof(Cell))
+#endif
 
 typedef enum {
     OP,     // f()
     OP_0,   // f(Stack *s)
     OP_1,   // f(Stack *s, Stack *rs)
-    OP_2,   // f(Stack *s, int *m)
-    OP_3    // f(Stack *s, uint8_t *m)
+    OP_2,   // f(Stack *s, Cell *m)
+    OP_3,   // f(Stack *s, uint8_t *m)
+    OP_COMPILER,    // f(), runs while compiling
+    OP_COLON,       // threaded code body
+    OP_LIT,         // threaded code: push inline literal
+    OP_RET,         // threaded code: return to caller
+    OP_SUPER,       // threaded code: fused superinstruction
+    OP_CONTROL      // threaded code: branch or loop, compiled by the control-flow words
 } OpType;
 
+/* one handler per primitive in the inner interpreter */
+typedef enum {
+    OPC_LIT, OPC_RET, OPC_CALL,
+    OPC_LESS_THAN, OPC_EQUAL, OPC_GREATER_THAN, OPC_ZERO_LESS, OPC_ZERO_EQUAL,
+    OPC_D_LESS,
+    OPC_ZERO_GREATER, OPC_NOT,
+    OPC_CR, OPC_EMIT, OPC_SPACE, OPC_SPACES, OPC_TYPE, OPC_COUNT,
+    OPC_DOT_QUOTE, OPC_S_QUOTE,
+    OPC_ADD, OPC_SUB, OPC_MUL, OPC_DIV, OPC_MOD, OPC_DIVMOD, OPC_ONE_PLUS,
+    OPC_ONE_MINUS, OPC_TWO_PLUS, OPC_TWO_MINUS, OPC_D_PLUS, OPC_MAX, OPC_MIN,
+    OPC_ABS, OPC_NEGATE, OPC_DNEGATE, OPC_AND, OPC_OR, OPC_XOR,
+    OPC_M_STAR, OPC_UM_STAR, OPC_UM_SLASH_MOD, OPC_STAR_SLASH, OPC_STAR_SLASH_MOD,
+    OPC_FETCH, OPC_STORE, OPC_CFETCH, OPC_CSTORE, OPC_QUESTION, OPC_MOVE,
+    OPC_CMOVE, OPC_FILL, OPC_CELLS_SUM, OPC_CELLS_MIN, OPC_CELLS_MAX,
+    OPC_CELLS_COMPARE, OPC_CELLS_SEARCH,
+    OPC_DUP, OPC_DROP, OPC_SWAP, OPC_OVER, OPC_ROT, OPC_PICK, OPC_ROLL,
+    OPC_DEPTH, OPC_TO_R, OPC_R_FROM, OPC_R_FETCH,
+    OPC_PRINT, OPC_D_PRINT, OPC_BASE, OPC_DECIMAL, OPC_HEX, OPC_BINARY,
+    OPC_COLON, OPC_SEMICOLON, OPC_TICK,
+    OPC_EXECUTE, OPC_CATCH, OPC_THROW, OPC_PAR_MAP, OPC_PAR_REDUCE,
+    OPC_EXIT,
+    OPC_CONTROL,    /* IF ... REPEAT: compile-only, they emit the threaded words below */
+    OPC_BRANCH, OPC_ZERO_BRANCH, OPC_TRUE_BRANCH,
+    OPC_DO, OPC_LOOP, OPC_PLUS_LOOP, OPC_I, OPC_J, OPC_LEAVE, OPC_UNLOOP,
+    OPC_FUSIONS, OPC_FLUSH, OPC_PROFILE_ON, OPC_PROFILE_OFF, OPC_PROFILE_DUMP,
+    OPC_SAVE_IMAGE, OPC_LOAD_IMAGE,
+    OPC_SPAWN, OPC_PAUSE, OPC_STOP, OPC_TASKS, OPC_USER_AREA,
+    OPC_NATIVE,     /* words registered by a program embedding libyafi */
+    /* superinstructions, produced by the peephole pass */
+    OPC_DUP_ADD, OPC_NIP, OPC_TWO_DUP, OPC_LIT_ADD, OPC_LIT_FETCH, OPC_LIT_STORE,
+    OPCODE_COUNT
+} Opcode;
+
 typedef void (*OpFunc)();
 typedef void (*OpFunc_S)(Stack *s);
 typedef void (*OpFunc_S_RS)(Stack *s, Stack *rs);
-typedef void (*OpFunc_S_M)(Stack *s, int *m); 
+typedef void (*OpFunc_S_M)(Stack *s, Cell *m); 
 typedef void (*OpFunc_S_BM)(Stack *s, uint8_t *m);
 
-typedef struct {
+typedef struct Instr Instr;
+typedef struct Definition Definition;
+typedef struct Vm Vm;
+
+typedef struct DictEntry {
     const char *word;
     OpType type;
     union {
@@ -45,10 +118,35 @@ typedef struct {
         OpFunc_S_RS fp_s_rs;
         OpFunc_S_M fp_s_m;
         OpFunc_S_BM fp_s_bm;
+        Definition *colon;
     } func;
+    Opcode opcode;
+    int8_t in;      // stack effect ( in -- out ), checked once per word
+    int8_t out;
 } DictEntry;
 
+/* a colon definition: threaded code, plus what the JIT knows about it */
+struct Definition {
+    Instr *body;
+    int length;
+    unsigned int calls;
+    const struct Native *native;
+};
+
+/* one cell of threaded code: handler, stack effect, inline operand, and the word it came from */
+struct Instr {
+    uint16_t op;
+    int8_t in;
+    int8_t out;
+    Cell value;
+    const DictEntry *entry;
+};
+
+#ifdef YAFI_CELL_64
+#define BANNER_YAFI     "YAFI - 64-bit Forth79 Interpreter (C) - 2025.\n"
+#else
 #define BANNER_YAFI     "YAFI - 32-bit Forth79 Interpreter (C) - 2025.\n"
+#endif
 #define BANNER_AUTHOR   "YAFI - Yet Another Forth Interpreter. Diederick de Buck.\n\n"
 #define BANNER_HELP     "Type 'exit' to quit.\n"
 
@@ -62,9 +160,12 @@ typedef struct {
 #define CSTORE      "C!"
 #define DEPTH       "DEPTH"
 #define DIV         "/"
+#define DLESS       "D<"
 #define DNEGATE     "DNEGATE"
 #define DPLUS       "D+"
+#define DPRINT      "D."
 #define DROP        "DROP"
+#define DOTQ        ".\""
 #define DUP         "DUP"
 #define EMIT        "EMIT"
 #define EQ          "="
@@ -76,6 +177,7 @@ typedef struct {
 #define MAX         "MAX"
 #define MIN         "MIN"
 #define MOD         "MOD"
+#define MSTAR       "M*"
 #define MOVE        "MOVE"
 #define MUL         "*"
 #define NEG         "0<"
@@ -95,6 +197,9 @@ typedef struct {
 #define ROT         "ROT"
 #define SPACE       "SPACE"
 #define SPACES      "SPACES"
+#define SQUOTE      "S\""
+#define SSLASH      "*/"
+#define SSLASHMOD   "*/MOD"
 #define STORE       "!"
 #define SUB         "-"
 #define SWAP        "SWAP"
@@ -102,9 +207,54 @@ typedef struct {
 #define TWO_MIN     "2-"
 #define TWO_PLUS    "2+"
 #define TYPE        "TYPE"
+#define UMSTAR      "UM*"
+#define UMSMOD      "UM/MOD"
 #define XOR         "XOR"
 #define ZERO        "0="
 #define DIVMOD      "/MOD"
+#define COLON       ":"
+#define SEMICOLON   ";"
+#define FUSIONS     ".FUSIONS"
+#define PON         "PROFILE-ON"
+#define POFF        "PROFILE-OFF"
+#define PDUMP       "PROFILE-DUMP"
+#define SAVEIMG     "SAVE-IMAGE"
+#define LOADIMG     "LOAD-IMAGE"
+#define SPAWN       "SPAWN"
+#define PAUSE       "PAUSE"
+#define STOP        "STOP"
+#define TASKS       "TASKS"
+#define USERAREA    "USER-AREA"
+#define BASE        "BASE"
+#define DECIMAL     "DECIMAL"
+#define HEX         "HEX"
+#define BIN         "BINARY"
+#define CSUM        "CELLS-SUM"
+#define CMIN        "CELLS-MIN"
+#define CMAX        "CELLS-MAX"
+#define CCMP        "CELLS-COMPARE"
+#define CFIND       "CELLS-SEARCH"
+#define FLUSH       "FLUSH"
+#define TICK        "'"
+#define EXECUTE     "EXECUTE"
+#define CATCH       "CATCH"
+#define PARMAP      "PAR-MAP"
+#define PARREDUCE   "PAR-REDUCE"
+#define THROW       "THROW"
+#define IF          "IF"
+#define ELSE        "ELSE"
+#define THEN        "THEN"
+#define BEGIN       "BEGIN"
+#define UNTIL       "UNTIL"
+#define WHILE       "WHILE"
+#define REPEAT      "REPEAT"
+#define AGAIN       "AGAIN"
+#define DO          "DO"
+#define LOOP        "LOOP"
+#define PLOOP       "+LOOP"
+#define INDEX_I     "I"
+#define INDEX_J     "J"
+#define LEAVE       "LEAVE"
 
 
 /* operations */
@@ -114,14 +264,22 @@ typedef struct {
 /* [C.04] */ void op_zero_less(Stack *s);
 /* [C.05] */ void op_zero_equal(Stack *s);
 /* [C.06] */ void op_zero_greater(Stack *s);
+/* [C.07] */ void op_d_less(Stack *s);
 /* [C.09] */ void op_not(Stack *s);
 /* [IOC.01] */ void op_cr();
 /* [IOC.02] */ void op_emit(Stack *s);
 /* [IOC.03] */ void op_space();
 /* [IOC.04] */ void op_spaces(Stack *s);
-/* [IOC.06] */ void op_type(Stack *s, int *m);
-/* [IOC.07] */void op_count(Stack *s, int *m);
-/* [ION.03] */ void op_print(Stack *s);
+/* [IOC.05] */ void op_dot_quote();
+/* [IOC.06] */ void op_type(Stack *s, uint8_t *m);
+/* [IOC.07] */ void op_count(Stack *s, uint8_t *m);
+/* [IOC.08] */ void op_s_quote();
+/* [ION.03] */ void op_print(Stack *s, Cell *m);
+/* [ION.08] */ void op_d_print(Stack *s, Cell *m);
+/* [ION.04] */ void op_base(Stack *s, Cell *m);
+/* [ION.05] */ void op_decimal(Stack *s, Cell *m);
+/* [ION.06] */ void op_hex(Stack *s, Cell *m);
+/* [ION.07] */ void op_binary(Stack *s, Cell *m);
 /* [L.01] */ void op_add(Stack *s);
 /* [L.02] */ void op_sub(Stack *s);
 /* [L.03] */ void op_mul(Stack *s);
@@ -133,6 +291,10 @@ typedef struct {
 /* [L.09] */ void op_two_plus(Stack *s);
 /* [L.10] */ void op_two_minus(Stack *s);
 /* [L.11] */ void op_d_plus(Stack *s);
+/* [L.12] */ void op_m_star(Stack *s);
+/* [L.13] */ void op_um_star(Stack *s);
+/* [L.14] */ void op_um_slash_mod(Stack *s);
+/* [L.15] */ void op_star_slash(Stack *s);
 /* [L.16] */ void op_max(Stack *s);
 /* [L.17] */void op_min(Stack *s);
 /* [L.18] */ void op_abs(Stack *s);
@@ -141,14 +303,20 @@ typedef struct {
 /* [L.21] */ void op_and(Stack *s);
 /* [L.22] */ void op_or(Stack *s);
 /* [L.23] */ void op_xor(Stack *s);
-/* [M.01] */ void op_fetch(Stack *s, int *m);
-/* [M.02] */ void op_store(Stack *s, int *m);
+/* [L.24] */ void op_star_slash_mod(Stack *s);
+/* [M.01] */ void op_fetch(Stack *s, Cell *m);
+/* [M.02] */ void op_store(Stack *s, Cell *m);
 /* [M.03] */ void op_cfetch(Stack *s, uint8_t *m);
 /* [M.04] */ void op_cstore(Stack *s, uint8_t *m);
-/* [M.05] */ void op_question(Stack *s, int *m);
+/* [M.05] */ void op_question(Stack *s, Cell *m);
 /* [M.07] */ void op_move(Stack *s, uint8_t *m);
 /* [M.08] */ void op_cmove(Stack *s, uint8_t *m);
 /* [M.09] */ void op_fill(Stack *s, uint8_t *m);
+/* [M.10] */ void op_cells_sum(Stack *s, Cell *m);
+/* [M.11] */ void op_cells_min(Stack *s, Cell *m);
+/* [M.12] */ void op_cells_max(Stack *s, Cell *m);
+/* [M.13] */ void op_cells_compare(Stack *s, Cell *m);
+/* [M.14] */ void op_cells_search(Stack *s, Cell *m);
 /* [S.01] */ void op_dup(Stack *s);
 /* [S.02] */ void op_drop(Stack *s);
 /* [S.03] */ void op_swap(Stack *s);
@@ -161,13 +329,59 @@ typedef struct {
 /* [S.11] */ void op_r_from(Stack *s, Stack *rs);
 /* [S.12] */ void op_r_fetch(Stack *s, Stack *rs);
 
+/* [D.01] */ void op_colon();
+/* [D.02] */ void op_semicolon();
+/* [D.03] */ void op_tick();
+
+/* [F.01] */ void op_if();
+/* [F.02] */ void op_else();
+/* [F.03] */ void op_then();
+/* [F.04] */ void op_begin();
+/* [F.05] */ void op_until();
+/* [F.06] */ void op_while();
+/* [F.07] */ void op_repeat();
+/* [F.08] */ void op_again();
+/* [F.09] */ void op_do();
+/* [F.10] */ void op_loop();
+/* [F.11] */ void op_plus_loop();
+/* [F.12] */ void op_i();
+/* [F.13] */ void op_j();
+/* [F.14] */ void op_leave();
+
+/* [X.01] */ void op_execute(Stack *s, Stack *rs);
+/* [X.02] */ void op_catch(Stack *s, Stack *rs);
+/* [X.03] */ void op_throw(Stack *s);
+/* [X.04] */ void op_par_map(Stack *s);
+/* [X.05] */ void op_par_reduce(Stack *s, Stack *rs);
+
+/* [T.01] */ void op_fusions();
+/* [T.02] */ void op_flush();
+/* [T.03] */ void op_profile_on();
+/* [T.04] */ void op_profile_off();
+/* [T.05] */ void op_profile_dump();
+/* [T.06] */ void op_save_image();
+/* [T.07] */ void op_load_image();
+
+/* [K.01] */ void op_spawn(Stack *s);
+/* [K.02] */ void op_pause();
+/* [K.03] */ void op_stop();
+/* [K.04] */ void op_tasks(Stack *s);
+/* [K.05] */ void op_user_area(Stack *s);
+
 /* pseudo */
 void op_exit();
 
 /* helpers */
-void to_uppercase(char *str);
-bool is_number(const char *token);
+int number_base(const Cell *memory);
+Cell strings_bottom(const Cell *memory);
+void init_memory(Cell *memory);
 void init_stack(Stack *s);
 
+/* interpreter */
+extern DictEntry dictionary[];
+bool interpret(Vm *vm, char *line);
+bool interpret_text(Vm *vm, const char *text, size_t length);
+void execute_primitive(const DictEntry *entry, Stack *stack, Stack *return_stack, Cell *memory);
+
 #endif
 
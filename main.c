@@ -0,0 +1,157 @@
+#include <unistd.h>
+#include "forth.h"
+#include "Dictionary.h"
+#include "Compiler.h"
+#include "Jit.h"
+#include "Output.h"
+#include "Source.h"
+#include "Vm.h"
+#include "Runner.h"
+#include "Par.h"
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--no-jit] [--flush=line|size|explicit] [--memory=SIZE]\n", program);
+    fprintf(stderr, "       [--memory-file=PATH] [--huge-pages] [--image=PATH] [--jobs=N]\n");
+    fprintf(stderr, "       [--threads=N] [--profile=PATH]\n");
+    fprintf(stderr, "       [-i] [file ...]\n");
+    fprintf(stderr, "  file      run script non-interactively, '-' is stdin\n");
+    fprintf(stderr, "  -i        interactive prompt even when stdin is not a terminal\n");
+    fprintf(stderr, "  --no-jit  interpret colon definitions only\n");
+    fprintf(stderr, "  --flush   when output is written: per line (terminal default),\n");
+    fprintf(stderr, "            when the buffer fills (default otherwise), or on FLUSH\n");
+    fprintf(stderr, "  --memory  bytes of VM memory, with an optional K, M or G suffix\n");
+    fprintf(stderr, "  --memory-file  map PATH at address 0; stores write through to it\n");
+    fprintf(stderr, "  --huge-pages   back VM memory with huge pages where possible\n");
+    fprintf(stderr, "  --image   start from a SAVE-IMAGE file: its words, stacks and memory,\n");
+    fprintf(stderr, "            mapped copy-on-write and shared with other processes using it\n");
+    fprintf(stderr, "  --jobs    run the files in parallel on N threads, each in its own VM;\n");
+    fprintf(stderr, "            output still appears in the order the files were given\n");
+    fprintf(stderr, "  --threads PAR-MAP and PAR-REDUCE run on N threads (default: one per core)\n");
+    fprintf(stderr, "  --profile PROFILE-DUMP writes folded stacks to PATH (default yafi.folded)\n");
+    fprintf(stderr, "            and execution counts to PATH.calls; needs make PROFILE=yes\n");
+    exit(EXIT_FAILURE);
+}
+
+/* "64M" -> cells; 0 when malformed */
+static size_t parse_cells(const char *text) {
+    char *end;
+    unsigned long long bytes = strtoull(text, &end, 10);
+    switch (*end) {
+        case 'G': case 'g': bytes <<= 10; /* fall through */
+        case 'M': case 'm': bytes <<= 10; /* fall through */
+        case 'K': case 'k': bytes <<= 10; end++; break;
+        default: break;
+    }
+    if (end == text || *end != '\0')
+        return 0;
+    return (size_t)(bytes / sizeof(Cell));
+}
+
+/*
+ *  REPL
+ */
+static void run_interactive(Vm *vm) {
+    Source source;
+    const char *line;
+    size_t length;
+
+    if (!source_open(&source, "-"))
+        return;
+
+    fprintf(stdout, BANNER_YAFI);
+    fprintf(stdout, BANNER_AUTHOR);
+    fprintf(stdout, BANNER_HELP);
+
+    while (true) {
+        fprintf(stdout, "> ");
+        output_flush();
+        if (!run_tasks(vm, &source) || !source_next_line(&source, &line, &length))
+            break;
+        vm_eval(vm, line, length);
+
+        fprintf(stdout, "\nStack: ");
+        for (int i = 0; i < vm->stack.top; i++) {
+            fprintf(stdout, "%" PRIdCELL " ", vm->stack.data[i]);
+        }
+        fprintf(stdout, "\n");
+    }
+    vm_run_tasks(vm, true);
+    source_close(&source);
+}
+
+/*
+ *  Main
+ */
+int main(int argc, char *argv[]) {
+    VmConfig config = vm_defaults();
+    bool interactive = false;
+    int jobs = 0;
+    int scripts = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-jit") == 0) {
+            jit_enabled = false;
+        } else if (strcmp(argv[i], "--flush=line") == 0) {
+            config.policy = FLUSH_LINE;
+        } else if (strcmp(argv[i], "--flush=size") == 0) {
+            config.policy = FLUSH_SIZE;
+        } else if (strcmp(argv[i], "--flush=explicit") == 0) {
+            config.policy = FLUSH_EXPLICIT;
+        } else if (strncmp(argv[i], "--memory=", 9) == 0) {
+            config.cells = parse_cells(argv[i] + 9);
+            if (config.cells == 0)
+                usage(argv[0]);
+        } else if (strncmp(argv[i], "--memory-file=", 14) == 0) {
+            config.memory_file = argv[i] + 14;
+        } else if (strncmp(argv[i], "--image=", 8) == 0) {
+            config.image = argv[i] + 8;
+        } else if (strcmp(argv[i], "--huge-pages") == 0) {
+            config.huge_pages = true;
+        } else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            jobs = atoi(argv[i] + 7);
+            if (jobs <= 0)
+                usage(argv[0]);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            par_threads = atoi(argv[i] + 10);
+            if (par_threads <= 0)
+                usage(argv[0]);
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            config.profile_path = argv[i] + 10;
+        } else if (strcmp(argv[i], "-i") == 0) {
+            interactive = true;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            usage(argv[0]);
+        } else {
+            argv[1 + scripts++] = argv[i];
+        }
+    }
+    if ((interactive && scripts > 0) || (jobs > 0 && scripts == 0) || (config.image && config.memory_file))
+        usage(argv[0]);
+
+    output_init();
+    init_dictionary();
+
+    if (jobs > 0)
+        return run_parallel(argv + 1, scripts, jobs, &config) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    Vm *vm = vm_create(&config);
+    if (!vm)
+        return EXIT_FAILURE;
+    vm_enter(vm);
+
+    if (interactive || (scripts == 0 && isatty(STDIN_FILENO))) {
+        run_interactive(vm);
+        return EXIT_SUCCESS;
+    }
+
+    bool ok = true;
+    if (scripts == 0)
+        ok = run_script(vm, "-");
+    for (int i = 1; i <= scripts && ok && !vm->halted; i++)
+        ok = run_script(vm, argv[i]);
+    if (ok && !vm->halted && is_compiling()) {
+        fprintf(stderr, "Unterminated definition at end of input\n");
+        ok = false;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,94 @@
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     libyafi
+ * License:         MIT
+ *
+ * A thin layer over Vm: the host gets the same VM the Forth binary runs,
+ * without stdio in between. Cells are exchanged through the data stack or
+ * read and written in place through yafi_memory().
+ */
+
+#include <pthread.h>
+#include "yafi.h"
+#include "Vm.h"
+
+static pthread_once_t ready = PTHREAD_ONCE_INIT;
+
+static void init_library(void) {
+    init_dictionary();
+}
+
+/* cells 0 takes the default size; out NULL writes to stdout; NULL when there is no memory for the VM */
+Vm *yafi_create(size_t cells, FILE *out) {
+    VmConfig config = vm_defaults();
+
+    pthread_once(&ready, init_library);
+    if (cells)
+        config.cells = cells;
+    if (out)
+        config.out = out;
+    config.shared_out = true;       /* the host may hand one stream to VMs on several threads */
+    return vm_create(&config);
+}
+
+void yafi_destroy(Vm *vm) {
+    vm_destroy(vm);
+}
+
+/* any number of lines; EXIT ends this evaluation only */
+bool yafi_eval(Vm *vm, const char *text, size_t length) {
+    vm->halted = false;
+    vm->status = EXIT_SUCCESS;
+    bool ok = vm_eval(vm, text, length);
+    fflush(vm->out);
+    return ok;
+}
+
+/* the name is copied and kept upper-case, as the compiler does */
+bool yafi_define(Vm *vm, const DictEntry *word) {
+    if (!word->word || word->word[0] == '\0' || word->type > OP_3)
+        return false;
+
+    size_t length = strlen(word->word);
+    DictEntry *entry = malloc(sizeof(DictEntry));
+    char *name = malloc(length + 1);
+    if (!entry || !name) {
+        free(entry);
+        free(name);
+        return false;
+    }
+    for (size_t i = 0; i <= length; i++)
+        name[i] = fold_case(word->word[i]);
+
+    *entry = *word;
+    entry->word = name;
+    entry->opcode = OPC_NATIVE;
+    vm_enter(vm);
+    add_entry(entry);
+    return true;
+}
+
+bool yafi_push(Vm *vm, Cell value) {
+    if (vm->stack.top >= STACK_SIZE)
+        return false;
+    vm->stack.data[vm->stack.top++] = value;
+    return true;
+}
+
+bool yafi_pop(Vm *vm, Cell *value) {
+    if (vm->stack.top == 0)
+        return false;
+    *value = vm->stack.data[--vm->stack.top];
+    return true;
+}
+
+int yafi_depth(const Vm *vm) {
+    return vm->stack.top;
+}
+
+/* the user cells, without the system cells above them */
+Cell *yafi_memory(Vm *vm, size_t *cells) {
+    if (cells)
+        *cells = (size_t)(vm->memory.cells - SYSTEM_CELLS);
+    return vm->memory.data;
+}
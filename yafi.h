@@ -0,0 +1,44 @@
+#ifndef YAFI_H
+#define YAFI_H
+
+/*
+ * Project:         Diederick's Forth-79 Interpreter
+ * Description:     libyafi: the interpreter as a library (make lib builds
+ *                  libyafi.a and libyafi.so)
+ * License:         MIT
+ *
+ *   Vm *vm = yafi_create(0, NULL);
+ *   yafi_define(vm, &(DictEntry){ "CLOCK", OP_0, {.fp_s = my_clock}, OPC_NATIVE, 0, 1 });
+ *   if (yafi_eval(vm, text, length) && yafi_pop(vm, &result))
+ *       ...
+ *   yafi_destroy(vm);
+ *
+ * Native words are DictEntry rows like those of dictionary[], with any of
+ * the OP, OP_0 .. OP_3 signatures; the opcode is always taken to be
+ * OPC_NATIVE. in and out are the stack effect, which is checked before the word is called; the word itself
+ * uses push() and pop() from Stack.h. A word defined in one VM is not seen
+ * by the others.
+ *
+ * yafi_create() returns NULL when the VM's memory cannot be had; it does
+ * not end the process. Several VMs may write to one stream, stdout included.
+ *
+ * A VM may be used from any thread, but by one thread at a time. A fault
+ * that no CATCH takes is reported on stderr, empties the stacks and makes
+ * yafi_eval() return false; the VM and its definitions stay usable.
+ */
+
+#include "forth.h"
+
+Vm *yafi_create(size_t cells, FILE *out);
+void yafi_destroy(Vm *vm);
+
+bool yafi_eval(Vm *vm, const char *text, size_t length);
+bool yafi_define(Vm *vm, const DictEntry *word);
+
+bool yafi_push(Vm *vm, Cell value);
+bool yafi_pop(Vm *vm, Cell *value);
+int yafi_depth(const Vm *vm);
+
+Cell *yafi_memory(Vm *vm, size_t *cells);
+
+#endif